@@ -0,0 +1,333 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "bitmapfont.h"
+
+#define PSF1_MAGIC0 0x36
+#define PSF1_MAGIC1 0x04
+#define PSF1_MODE512 0x01
+#define PSF1_MODEHASTAB 0x02
+#define PSF1_MODEHASSEQ 0x04
+#define PSF1_SEPARATOR 0xffff
+#define PSF1_STARTSEQ 0xfffe
+
+#define PSF2_MAGIC 0x864ab572
+#define PSF2_HAS_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR 0xff
+#define PSF2_STARTSEQ 0xfe
+
+// bdf glyphs are converted into memory, a full Unicode font of large glyphs fits in this
+#define BDF_MAX_BYTES (64 << 20)
+
+struct Psf2Header {
+	u32 magic, version, headersize, flags;
+	u32 length, charsize, height, width;
+};
+
+BitmapFont *BitmapFont::load(const s8 *name)
+{
+	s32 fd = open(name, O_RDONLY);
+	if (fd == -1) return 0;
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 4) map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) return 0;
+
+	BitmapFont *font = new BitmapFont();
+	snprintf(font->mName, sizeof(font->mName), "%s", name);
+
+	// psf glyphs are used from the mapping, bdf ones are converted and the file released
+	bool ok;
+	if (!strncmp((const s8 *)map, "STARTFONT", 9)) {
+		ok = font->loadBdf((const s8 *)map, st.st_size);
+		munmap(map, st.st_size);
+	} else {
+		font->mMap = map;
+		font->mMapSize = st.st_size;
+		ok = font->loadPsf((const u8 *)map, st.st_size);
+	}
+
+	if (ok && font->mCharCount) {
+		font->sortMap();
+		return font;
+	}
+
+	delete font;
+	return 0;
+}
+
+BitmapFont::BitmapFont()
+{
+	mWidth = mHeight = mBaseline = mBoxWidth = mPitch = 0;
+	mGlyphCount = 0;
+	mGlyphs = mOwnGlyphs = 0;
+	mMap = 0;
+	mMapSize = 0;
+	mChars = 0;
+	mCharCount = mCharMax = 0;
+	mName[0] = 0;
+}
+
+BitmapFont::~BitmapFont()
+{
+	if (mMap) munmap(mMap, mMapSize);
+	if (mOwnGlyphs) delete[] mOwnGlyphs;
+	if (mChars) free(mChars);
+}
+
+void BitmapFont::addChar(u32 unicode, u32 index)
+{
+	if (unicode > 0x10ffff || index >= mGlyphCount) return;
+
+	if (mCharCount == mCharMax) {
+		mCharMax = mCharMax ? mCharMax * 2 : 512;
+		mChars = (CharMap *)realloc(mChars, sizeof(CharMap) * mCharMax);
+	}
+
+	mChars[mCharCount].unicode = unicode;
+	mChars[mCharCount].index = index;
+	mCharCount++;
+}
+
+static int compareChar(const void *a, const void *b)
+{
+	u32 ua = *(const u32 *)a, ub = *(const u32 *)b;
+	return ua < ub ? -1 : ua > ub;
+}
+
+void BitmapFont::sortMap()
+{
+	qsort(mChars, mCharCount, sizeof(CharMap), compareChar);
+}
+
+s32 BitmapFont::glyphIndex(u32 unicode)
+{
+	u32 low = 0, high = mCharCount;
+	while (low < high) {
+		u32 mid = (low + high) / 2;
+		if (mChars[mid].unicode < unicode) low = mid + 1;
+		else high = mid;
+	}
+
+	return (low < mCharCount && mChars[low].unicode == unicode) ? (s32)mChars[low].index : -1;
+}
+
+static u32 decodeUtf8(const u8 *&cur, const u8 *end)
+{
+	u32 c = *cur++, more = 0;
+	if (c >= 0xf0) { c &= 0x07; more = 3; }
+	else if (c >= 0xe0) { c &= 0x0f; more = 2; }
+	else if (c >= 0xc0) { c &= 0x1f; more = 1; }
+
+	for (; more-- && cur < end && (*cur & 0xc0) == 0x80; cur++) {
+		c = (c << 6) | (*cur & 0x3f);
+	}
+
+	return c;
+}
+
+bool BitmapFont::loadPsf(const u8 *data, u32 size)
+{
+	bool psf1 = (data[0] == PSF1_MAGIC0 && data[1] == PSF1_MAGIC1), hasTable;
+	u32 offset;
+
+	if (psf1) {
+		mWidth = 8;
+		mHeight = data[3];
+		mPitch = 1;
+		mGlyphCount = (data[2] & PSF1_MODE512) ? 512 : 256;
+		offset = 4;
+		hasTable = (data[2] & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ));
+	} else {
+		if (size < sizeof(Psf2Header)) return false;
+
+		Psf2Header header;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != PSF2_MAGIC || header.headersize > size) return false;
+
+		// the same limits as bdf fonts, the cell is built from them
+		if (header.width > 256 || header.height > 256) return false;
+
+		mWidth = header.width;
+		mHeight = header.height;
+		mPitch = (mWidth + 7) >> 3;
+		if (header.charsize != mPitch * mHeight) return false;
+
+		mGlyphCount = header.length;
+		offset = header.headersize;
+		hasTable = (header.flags & PSF2_HAS_UNICODE_TABLE);
+	}
+
+	// the glyph count comes from the file, it must not wrap the size of the glyphs
+	if (!mWidth || !mHeight || (u64)mGlyphCount * mPitch * mHeight > size - offset) return false;
+
+	mGlyphs = data + offset;
+	const u8 *table = (hasTable ? mGlyphs + mGlyphCount * mPitch * mHeight : 0);
+
+	mBoxWidth = mWidth;
+	mBaseline = (mHeight * 13 + 8) / 16;
+
+	// without a unicode table glyphs are in code point order
+	if (!table) {
+		for (u32 i = 0; i < mGlyphCount; i++) addChar(i, i);
+		return true;
+	}
+
+	// each glyph lists its characters and then character sequences, which are skipped
+	const u8 *cur = table, *end = data + size;
+	for (u32 index = 0; index < mGlyphCount && cur < end; index++) {
+		bool seq = false;
+
+		if (psf1) {
+			for (; cur + 1 < end; cur += 2) {
+				u32 c = cur[0] | (cur[1] << 8);
+				if (c == PSF1_SEPARATOR) break;
+				if (c == PSF1_STARTSEQ) seq = true;
+				else if (!seq) addChar(c, index);
+			}
+			cur += 2;
+		} else {
+			while (cur < end) {
+				if (*cur == PSF2_SEPARATOR) break;
+				if (*cur == PSF2_STARTSEQ) {
+					seq = true;
+					cur++;
+					continue;
+				}
+
+				u32 c = decodeUtf8(cur, end);
+				if (!seq) addChar(c, index);
+			}
+			cur++;
+		}
+	}
+
+	return true;
+}
+
+// copy a line of text to buf, returns the start of the next one
+static const s8 *nextLine(const s8 *cur, const s8 *end, s8 *buf, u32 size)
+{
+	const s8 *eol = (const s8 *)memchr(cur, '\n', end - cur);
+
+	u32 len = (eol ? eol : end) - cur;
+	if (len >= size) len = size - 1;
+
+	memcpy(buf, cur, len);
+	buf[len] = 0;
+	return eol ? eol + 1 : end;
+}
+
+// bdf fonts are text, every glyph has its own bounding box placed relative to the baseline.
+// the cell is as wide as the glyph of 'M', boxes are two cells wide to hold wide glyphs
+bool BitmapFont::loadBdf(const s8 *data, u32 size)
+{
+	s32 fontw = 0, fonth = 0, fontx = 0, fonty = 0, ascent = -1, descent = -1, mwidth = 0;
+
+	const s8 *cur = data, *end = data + size;
+	s8 line[256];
+
+	// first pass for the font metrics and the number of glyphs
+	s32 encoding = -1;
+	while (cur < end) {
+		cur = nextLine(cur, end, line, sizeof(line));
+
+		if (sscanf(line, "FONTBOUNDINGBOX %d %d %d %d", &fontw, &fonth, &fontx, &fonty) == 4) continue;
+		if (sscanf(line, "FONT_ASCENT %d", &ascent) == 1) continue;
+		if (sscanf(line, "FONT_DESCENT %d", &descent) == 1) continue;
+
+		if (sscanf(line, "ENCODING %d", &encoding) == 1) {
+			if (encoding >= 0) mGlyphCount++;
+			continue;
+		}
+
+		s32 dw;
+		if (encoding == 'M' && sscanf(line, "DWIDTH %d", &dw) == 1) mwidth = dw;
+	}
+
+	if (ascent < 0 || descent < 0) {
+		ascent = fonth + fonty;
+		descent = -fonty;
+	}
+
+	mWidth = (mwidth > 0 ? mwidth : fontw);
+	mHeight = ascent + descent;
+	mBaseline = ascent;
+	mBoxWidth = mWidth * 2;
+	mPitch = (mBoxWidth + 7) >> 3;
+
+	if (!mGlyphCount || !mWidth || mHeight <= 0 || mHeight > 256 || mWidth > 256) return false;
+
+	// the glyph count comes from the file, the size of the glyphs must not wrap
+	u64 bytes = (u64)mGlyphCount * mPitch * mHeight;
+	if (bytes > BDF_MAX_BYTES) return false;
+
+	mOwnGlyphs = new u8[bytes];
+	memset(mOwnGlyphs, 0, bytes);
+	mGlyphs = mOwnGlyphs;
+
+	// second pass copies every bitmap into its box
+	u32 index = 0;
+	s32 bw = 0, bh = 0, bx = 0, by = 0, row = -1;
+	encoding = -1;
+
+	for (cur = data; cur < end && index < mGlyphCount;) {
+		cur = nextLine(cur, end, line, sizeof(line));
+
+		if (row >= 0) {
+			if (!strncmp(line, "ENDCHAR", 7)) {
+				addChar(encoding, index++);
+				row = -1;
+				continue;
+			}
+
+			s32 y = ascent - (by + bh) + row++;
+			if (y < 0 || y >= (s32)mHeight) continue;
+
+			u8 *dst = mOwnGlyphs + ((size_t)index * mHeight + y) * mPitch;
+			for (s32 x = 0; x < bw && line[x / 4]; x++) {
+				s8 hex[2] = { line[x / 4], 0 };
+				u32 nibble = strtoul(hex, 0, 16);
+
+				s32 dx = bx + x;
+				if (dx < 0 || dx >= (s32)mBoxWidth || !(nibble & (8 >> (x & 3)))) continue;
+				dst[dx >> 3] |= 0x80 >> (dx & 7);
+			}
+			continue;
+		}
+
+		if (sscanf(line, "ENCODING %d", &encoding) == 1) continue;
+		if (sscanf(line, "BBX %d %d %d %d", &bw, &bh, &bx, &by) == 4) continue;
+		if (!strncmp(line, "BITMAP", 6) && encoding >= 0) row = 0;
+	}
+
+	mGlyphCount = index;
+	return true;
+}
@@ -0,0 +1,69 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef BITMAPFONT_H
+#define BITMAPFONT_H
+
+#include "type.h"
+
+// console fonts loaded without fontconfig and FreeType: PSF1 and PSF2 files are mapped and
+// their glyphs used in place, BDF files are converted to the same layout on loading.
+// every glyph is a box of boxWidth() x height() pixels, 1 bit per pixel, most significant
+// bit first, with the glyph placed in it as in the character cell.
+class BitmapFont {
+public:
+	static BitmapFont *load(const s8 *name);
+	~BitmapFont();
+
+	u32 width() { return mWidth; }
+	u32 height() { return mHeight; }
+	u32 baseline() { return mBaseline; }
+	u32 boxWidth() { return mBoxWidth; }
+	u32 pitch() { return mPitch; }
+	const s8 *name() { return mName; }
+
+	// glyph number of the character, -1 if the font hasn't it
+	s32 glyphIndex(u32 unicode);
+	const u8 *glyph(u32 index) { return mGlyphs + (size_t)index * mPitch * mHeight; }
+
+private:
+	BitmapFont();
+	bool loadPsf(const u8 *data, u32 size);
+	bool loadBdf(const s8 *data, u32 size);
+	void addChar(u32 unicode, u32 index);
+	void sortMap();
+
+	struct CharMap {
+		u32 unicode, index;
+	};
+
+	u32 mWidth, mHeight, mBaseline, mBoxWidth, mPitch;
+	u32 mGlyphCount;
+	const u8 *mGlyphs;
+	u8 *mOwnGlyphs;
+	void *mMap;
+	u32 mMapSize;
+
+	CharMap *mChars;
+	u32 mCharCount, mCharMax;
+	s8 mName[128];
+};
+
+#endif
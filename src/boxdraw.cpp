@@ -0,0 +1,259 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+#include "boxdraw.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+// weights of the four arms of a box drawing character, up << 6 | right << 4 | down << 2 | left,
+// 0 for characters drawn otherwise
+enum { NONE, LIGHT, HEAVY, DOUBLE };
+#define A(u, r, d, l) ((u) << 6 | (r) << 4 | (d) << 2 | (l))
+
+static const u8 boxArms[0x80] = {
+	A(0,1,0,1), A(0,2,0,2), A(1,0,1,0), A(2,0,2,0), 0, 0, 0, 0,
+	0, 0, 0, 0, A(0,1,1,0), A(0,2,1,0), A(0,1,2,0), A(0,2,2,0),
+	A(0,0,1,1), A(0,0,1,2), A(0,0,2,1), A(0,0,2,2), A(1,1,0,0), A(1,2,0,0), A(2,1,0,0), A(2,2,0,0),
+	A(1,0,0,1), A(1,0,0,2), A(2,0,0,1), A(2,0,0,2), A(1,1,1,0), A(1,2,1,0), A(2,1,1,0), A(1,1,2,0),
+	A(2,1,2,0), A(2,2,1,0), A(1,2,2,0), A(2,2,2,0), A(1,0,1,1), A(1,0,1,2), A(2,0,1,1), A(1,0,2,1),
+	A(2,0,2,1), A(2,0,1,2), A(1,0,2,2), A(2,0,2,2), A(0,1,1,1), A(0,1,1,2), A(0,2,1,1), A(0,2,1,2),
+	A(0,1,2,1), A(0,1,2,2), A(0,2,2,1), A(0,2,2,2), A(1,1,0,1), A(1,1,0,2), A(1,2,0,1), A(1,2,0,2),
+	A(2,1,0,1), A(2,1,0,2), A(2,2,0,1), A(2,2,0,2), A(1,1,1,1), A(1,1,1,2), A(1,2,1,1), A(1,2,1,2),
+	A(2,1,1,1), A(1,1,2,1), A(2,1,2,1), A(2,1,1,2), A(2,2,1,1), A(1,1,2,2), A(1,2,2,1), A(2,2,1,2),
+	A(1,2,2,2), A(2,1,2,2), A(2,2,2,1), A(2,2,2,2), 0, 0, 0, 0,
+	A(0,3,0,3), A(3,0,3,0), A(0,3,1,0), A(0,1,3,0), A(0,3,3,0), A(0,0,1,3), A(0,0,3,1), A(0,0,3,3),
+	A(1,3,0,0), A(3,1,0,0), A(3,3,0,0), A(1,0,0,3), A(3,0,0,1), A(3,0,0,3), A(1,3,1,0), A(3,1,3,0),
+	A(3,3,3,0), A(1,0,1,3), A(3,0,3,1), A(3,0,3,3), A(0,3,1,3), A(0,1,3,1), A(0,3,3,3), A(1,3,0,3),
+	A(3,1,0,1), A(3,3,0,3), A(1,3,1,3), A(3,1,3,1), A(3,3,3,3), 0, 0, 0,
+	0, 0, 0, 0, A(0,0,0,1), A(1,0,0,0), A(0,1,0,0), A(0,0,1,0),
+	A(0,0,0,2), A(2,0,0,0), A(0,2,0,0), A(0,0,2,0), A(0,2,0,1), A(1,0,2,0), A(0,1,0,2), A(2,0,1,0),
+};
+
+// filled quadrants of U+2596-259F, upper left = 1, upper right = 2, lower left = 4, lower right = 8
+static const u8 quadrants[10] = { 4, 8, 1, 13, 9, 7, 11, 2, 6, 14 };
+
+struct Cell {
+	u8 *pixels;
+	s32 width, height;
+
+	void fill(s32 x0, s32 y0, s32 x1, s32 y1, u8 value) {
+		x0 = MAX(x0, 0), y0 = MAX(y0, 0);
+		x1 = MIN(x1, width), y1 = MIN(y1, height);
+
+		for (s32 y = y0; y < y1; y++) {
+			if (x1 > x0) memset(pixels + y * width + x0, value, x1 - x0);
+		}
+	}
+
+	void blend(s32 x, s32 y, float coverage) {
+		if (coverage <= 0) return;
+
+		u8 value = (coverage >= 1 ? 0xff : (u8)(coverage * 0xff + 0.5f));
+		u8 &pixel = pixels[y * width + x];
+		if (value > pixel) pixel = value;
+	}
+};
+
+// line widths follow the cell height, so narrow and wide cells of a row match
+static s32 lightWidth(s32 height)
+{
+	return MAX(1, (height + 8) / 18);
+}
+
+static void drawLines(Cell &cell, u32 arms, s32 t)
+{
+	s32 w = cell.width, h = cell.height;
+	s32 weight[4] = { 0, t, t + MAX(2, t), 3 * t };
+
+	u32 up = arms >> 6, right = (arms >> 4) & 3, down = (arms >> 2) & 3, left = arms & 3;
+	s32 vm = MAX(weight[up], weight[down]), hm = MAX(weight[left], weight[right]);
+	s32 hx = (w - vm) / 2, vy = (h - hm) / 2;
+
+	// a line crossing a double line stops at its near stroke, unless it goes on at the other side
+	bool hdouble = (left == DOUBLE && right == DOUBLE), vdouble = (up == DOUBLE && down == DOUBLE);
+
+	// double arms are drawn as a bar with the gap cut out, single ones are drawn over the gaps
+	for (u32 pass = 0; pass < 3; pass++) {
+		for (u32 arm = 0; arm < 4; arm++) {
+			u32 kind = (arms >> (6 - arm * 2)) & 3;
+			if (!kind || (kind == DOUBLE) != (pass < 2)) continue;
+
+			s32 own = weight[kind], gap = (pass == 1 ? t : 0);
+			bool vertical = !(arm & 1);
+			s32 len = (vertical ? h : w), across = (vertical ? w : h);
+			s32 meet = (vertical ? hm : vm), at = (vertical ? vy : hx);
+			bool cross = (vertical ? hdouble && !(up && down) : vdouble && !(left && right));
+
+			// extent of the arm from the cell edge towards the centre, or from the centre outwards
+			s32 start, end;
+			bool toEdge = (arm == 1 || arm == 2);
+			if (!meet) {
+				start = (len - own) / 2;
+				end = start + own;
+			} else if (cross && kind != DOUBLE) {
+				start = at + 2 * t;
+				end = at + t;
+			} else {
+				start = at + (meet == 3 * t && gap ? t : 0);
+				end = at + meet - (meet == 3 * t && gap ? t : 0);
+			}
+
+			s32 a = (toEdge ? start : 0), b = (toEdge ? len : end);
+			s32 c = (across - own) / 2 + gap, d = c + own - 2 * gap;
+			u8 value = (pass == 1 ? 0 : 0xff);
+
+			if (vertical) cell.fill(c, a, d, b, value);
+			else cell.fill(a, c, b, d, value);
+		}
+	}
+}
+
+static void drawDashes(Cell &cell, u32 n, bool heavy, bool vertical, s32 t)
+{
+	s32 own = (heavy ? t + MAX(2, t) : t);
+	s32 len = (vertical ? cell.height : cell.width), across = (vertical ? cell.width : cell.height);
+	s32 c = (across - own) / 2;
+
+	for (u32 i = 0; i < n; i++) {
+		s32 a = i * len / n, b = (i + 1) * len / n;
+		s32 gap = MAX(1, (b - a) / 3);
+		a += gap / 2;
+		b -= gap - gap / 2;
+
+		if (vertical) cell.fill(c, a, c + own, b, 0xff);
+		else cell.fill(a, c, b, c + own, 0xff);
+	}
+}
+
+// a quarter circle joining the centre lines of two adjacent edges, dx and dy point to them
+static void drawArc(Cell &cell, s32 dx, s32 dy, s32 t)
+{
+	float cx = (cell.width - t) / 2 + t / 2.0f, cy = (cell.height - t) / 2 + t / 2.0f;
+	float r = MIN(dx > 0 ? cell.width - cx : cx, dy > 0 ? cell.height - cy : cy);
+	float ox = cx + dx * r, oy = cy + dy * r;
+
+	for (s32 y = 0; y < cell.height; y++) {
+		for (s32 x = 0; x < cell.width; x++) {
+			float px = x + 0.5f, py = y + 0.5f, dist;
+			bool beyondx = (px - ox) * dx > 0, beyondy = (py - oy) * dy > 0;
+
+			if (beyondx && beyondy) continue;
+			else if (beyondx) dist = fabsf(py - cy);
+			else if (beyondy) dist = fabsf(px - cx);
+			else dist = fabsf(sqrtf((px - ox) * (px - ox) + (py - oy) * (py - oy)) - r);
+
+			cell.blend(x, y, t / 2.0f + 0.5f - dist);
+		}
+	}
+}
+
+// diagonals run corner to corner, so they continue into the neighbouring cells
+static void drawDiagonal(Cell &cell, bool rising, s32 t)
+{
+	float w = cell.width, h = cell.height, norm = sqrtf(w * w + h * h);
+
+	for (s32 y = 0; y < cell.height; y++) {
+		for (s32 x = 0; x < cell.width; x++) {
+			float px = x + 0.5f, py = y + 0.5f;
+			float dist = fabsf(rising ? h * px + w * py - w * h : h * px - w * py) / norm;
+			cell.blend(x, y, t / 2.0f + 0.5f - dist);
+		}
+	}
+}
+
+static void drawBlock(Cell &cell, u32 unicode)
+{
+	s32 w = cell.width, h = cell.height;
+	s32 xs = (w + 1) / 2, ys = h / 2;
+
+	if (unicode == 0x2580) {
+		cell.fill(0, 0, w, ys, 0xff);
+	} else if (unicode <= 0x2588) {
+		cell.fill(0, h - (h * (unicode - 0x2580) + 4) / 8, w, h, 0xff);
+	} else if (unicode <= 0x258f) {
+		cell.fill(0, 0, (w * (0x2590 - unicode) + 4) / 8, h, 0xff);
+	} else if (unicode == 0x2590) {
+		cell.fill(xs, 0, w, h, 0xff);
+	} else if (unicode <= 0x2593) {
+		cell.fill(0, 0, w, h, (unicode - 0x2590) * 0x40);
+	} else if (unicode == 0x2594) {
+		cell.fill(0, 0, w, (h + 4) / 8, 0xff);
+	} else if (unicode == 0x2595) {
+		cell.fill(w - (w + 4) / 8, 0, w, h, 0xff);
+	} else {
+		u8 bits = quadrants[unicode - 0x2596];
+		if (bits & 1) cell.fill(0, 0, xs, ys, 0xff);
+		if (bits & 2) cell.fill(xs, 0, w, ys, 0xff);
+		if (bits & 4) cell.fill(0, ys, xs, h, 0xff);
+		if (bits & 8) cell.fill(xs, ys, w, h, 0xff);
+	}
+}
+
+// dots 1-3 and 7 are the left column from the top, 4-6 and 8 the right one
+static void drawBraille(Cell &cell, u32 dots)
+{
+	static const u8 dotColumn[8] = { 0, 0, 0, 1, 1, 1, 0, 1 };
+	static const u8 dotRow[8] = { 0, 1, 2, 0, 1, 2, 3, 3 };
+
+	s32 w = cell.width, h = cell.height;
+	s32 size = MAX(1, MIN(w / 4, h / 8));
+
+	for (u32 i = 0; i < 8; i++) {
+		if (!(dots & (1 << i))) continue;
+
+		s32 x = w * (2 * dotColumn[i] + 1) / 4 - size / 2;
+		s32 y = h * (2 * dotRow[i] + 1) / 8 - size / 2;
+		cell.fill(x, y, x + size, y + size, 0xff);
+	}
+}
+
+bool isBoxChar(u32 unicode)
+{
+	return (unicode >= 0x2500 && unicode <= 0x259f) || (unicode >= 0x2800 && unicode <= 0x28ff);
+}
+
+void drawBoxChar(u32 unicode, u8 *pixels, u32 width, u32 height)
+{
+	Cell cell = { pixels, (s32)width, (s32)height };
+	memset(pixels, 0, width * height);
+
+	s32 t = lightWidth(height);
+
+	if (unicode >= 0x2800) {
+		drawBraille(cell, unicode - 0x2800);
+	} else if (unicode >= 0x2580) {
+		drawBlock(cell, unicode);
+	} else if (boxArms[unicode - 0x2500]) {
+		drawLines(cell, boxArms[unicode - 0x2500], t);
+	} else if (unicode <= 0x250b) {
+		drawDashes(cell, unicode < 0x2508 ? 3 : 4, unicode & 1, unicode & 2, t);
+	} else if (unicode <= 0x254f) {
+		drawDashes(cell, 2, unicode & 1, unicode & 2, t);
+	} else if (unicode <= 0x2570) {
+		static const s8 arcs[4][2] = { { 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 } };
+		drawArc(cell, arcs[unicode - 0x256d][0], arcs[unicode - 0x256d][1], t);
+	} else {
+		if (unicode != 0x2572) drawDiagonal(cell, true, t);
+		if (unicode != 0x2571) drawDiagonal(cell, false, t);
+	}
+}
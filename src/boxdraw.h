@@ -0,0 +1,33 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef BOXDRAW_H
+#define BOXDRAW_H
+
+#include "type.h"
+
+// box drawing (U+2500-257F), block elements (U+2580-259F) and braille (U+2800-28FF) are
+// drawn from the cell size instead of taken from fonts, so lines meet across cells.
+bool isBoxChar(u32 unicode);
+
+// draw the character to a width x height cell with a byte of coverage per pixel
+void drawBoxChar(u32 unicode, u8 *pixels, u32 width, u32 height);
+
+#endif
@@ -170,9 +170,18 @@ void Config::checkConfigFile(const s8 *name)
 		"\n\n"
 		"# font family names/pixelsize used by fbterm, multiple font family names must be seperated by ','\n"
 		"# and using a fixed width font as the first is strongly recommended\n"
+		"# CTRL_ALT_EQUAL/CTRL_ALT_MINUS zoom all windows in steps of a sixth of font-size\n"
 		"font-names=mono\n"
 		"font-size=12\n"
 		"\n"
+		"# uncompressed PSF1, PSF2 or BDF console font used instead of font-names/font-size, characters it\n"
+		"# hasn't are taken from the font-names fonts unless font-fallback is no\n"
+		"#font-file=\n"
+		"#font-fallback=yes\n"
+		"\n"
+		"# draw box drawing, block element and braille characters to fill the cell instead of taking them from fonts\n"
+		"#box-drawing=yes\n"
+		"\n"
 		"# force font width/height/baseline, usually for non-fixed width fonts\n"
 		"# legal value format: n (fw_new = n), +n (fw_new = fw_old + n), -n (fw_new = fw_old - n)\n"
 		"#font-width=\n"
@@ -211,6 +220,39 @@ void Config::checkConfigFile(const s8 *name)
 		"\n"
 		"# set TERM to 'linux' instead of the default 'fbterm'\n"
 		"#term-is-linux=no\n"
+		"\n"
+		"# number of threads drawing large screen updates, 0 means one per online cpu, 1 disables threading\n"
+		"#render-threads=0\n"
+		"\n"
+		"# paint the screen in a separate thread, parsing shell output doesn't wait for painting\n"
+		"#render-pipeline=no\n"
+		"\n"
+		"# number of threads reading and parsing output of inactive windows, 0 means the main thread does it\n"
+		"#parse-threads=2\n"
+		"\n"
+		"# time different ways of writing video memory on first start and use the fastest,\n"
+		"# results are kept per device in ~/.fbterm-calibration, remove that file to measure again\n"
+		"#calibrate-video=no\n"
+		"\n"
+		"# megabytes used to keep the screen content of inactive windows, so switching to them doesn't\n"
+		"# repaint everything, 0 means disable it\n"
+		"#surface-memory=0\n"
+		"\n"
+		"# megabytes used to cache rendered glyphs, least recently used glyphs are dropped beyond it\n"
+		"#glyph-cache-memory=4\n"
+		"\n"
+		"# number of threads rendering glyphs ahead of use, 0 disables them\n"
+		"# hexadecimal code point ranges rendered ahead at startup\n"
+		"#prerender-threads=1\n"
+		"#prerender-glyphs=20-7e,a0-ff,2500-259f\n"
+		"\n"
+		"# megabytes of a file in ~/.cache/fbterm keeping rendered glyphs across restarts, shared by\n"
+		"# all fbterm instances with the same fonts, 0 means disable it\n"
+		"#glyph-disk-cache=0\n"
+		"\n"
+		"# file the glyph cache statistics and the last million draws in order are written to on exit\n"
+		"# and on SIGQUIT, for the glyphstat tool in the source tree. nothing is counted when it's empty\n"
+		"#glyph-stats=\n"
 		;
 
 	struct stat cstat;
@@ -95,6 +95,14 @@ FbDev::FbDev()
 	mBytesPerLine = finfo.line_length;
 	mVMemBase = (u8 *)mmap(0, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fbdev_fd, 0);
 
+	setupScroll();
+}
+
+// panning moves whole text rows, so the pan step must divide the cell height
+void FbDev::setupScroll()
+{
+	mScrollType = Redraw;
+	mOffsetMax = 0;
 
 	if (mRotateType == Rotate0 || mRotateType == Rotate180) {
 		bool ypan = (vinfo.yres_virtual > vinfo.yres && finfo.ypanstep && !(FH(1) % finfo.ypanstep));
@@ -33,6 +33,7 @@ private:
 
 	virtual void setupOffset();
 	virtual void setupPalette(bool restore);
+	virtual void setupScroll();
 	virtual const s8 *drvId();
 };
 #endif
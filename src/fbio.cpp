@@ -18,10 +18,15 @@
  *
  */
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "config.h"
 #include "fbio.h"
+#include "fbconfig.h"
 
 #define NR_FDS 32
 
@@ -30,12 +35,149 @@
 #define NR_EPOLL_FDS 10
 s32 epollFd;
 #else
-static fd_set fds;
+static fd_set fds, wfds;
 static u32 maxfd = 0;
 #endif
 
 static IoPipe *ioPipeMap[NR_FDS];
 
+// sources are watched for being writable only while they have output queued, and reading one
+// can be paused while the pipe it feeds is backed up
+static bool writeWatch[NR_FDS], readPaused[NR_FDS];
+
+// background shells share a byte budget per iteration by deficit round-robin, a source whose
+// deficit runs out isn't read and its output waits in the pty until it gets a turn again
+#define BG_BUDGET 16384
+
+static u8 ioPriority[NR_FDS];
+static s32 bgDeficit[NR_FDS];
+static u64 readySince[NR_FDS];
+
+static struct {
+	u32 events;
+	u64 total, max;
+} latency[FbIoDispatcher::NR_PRIOS];
+
+#ifdef HAVE_EPOLL
+static u32 watchEvents(s32 fd)
+{
+	return (__atomic_load_n(&readPaused[fd], __ATOMIC_RELAXED) ? 0 : EPOLLIN)
+		| (__atomic_load_n(&writeWatch[fd], __ATOMIC_RELAXED) ? EPOLLOUT : 0);
+}
+#endif
+
+static u64 now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+#ifdef HAVE_EPOLL
+// sources of inactive shells are read and parsed by background threads sharing one epoll set,
+// each event is delivered to a single thread and the source is re-armed after it's handled
+#define MAX_BG_THREADS 8
+static s32 bgEpollFd = -1;
+static u32 bgThreadNum;
+static pthread_t bgThreads[MAX_BG_THREADS];
+static pthread_mutex_t bgLock[NR_FDS];
+static bool bgSource[NR_FDS];
+
+// the source a background thread is handling, it re-arms the source itself afterwards
+static __thread s32 bgHandling = -1;
+
+static void *bgThreadEntry(void *)
+{
+	epoll_event ev;
+	while (1) {
+		if (epoll_wait(bgEpollFd, &ev, 1, -1) != 1) continue;
+
+		s32 fd = ev.data.fd;
+		if (fd < 0) break;
+
+		pthread_mutex_lock(&bgLock[fd]);
+
+		// the source may have been taken back while this event was pending
+		if (bgSource[fd] && ioPipeMap[fd]) {
+			bgHandling = fd;
+			if (ev.events & EPOLLIN) ioPipeMap[fd]->ready(true);
+			if (ev.events & EPOLLOUT) ioPipeMap[fd]->ready(false);
+			bgHandling = -1;
+
+			// hung up sources are left to the main loop, which deletes them
+			if (ev.events & EPOLLHUP) {
+				bgSource[fd] = false;
+				epoll_ctl(bgEpollFd, EPOLL_CTL_DEL, fd, &ev);
+
+				epoll_event mev;
+				mev.data.fd = fd;
+				mev.events = watchEvents(fd);
+				epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &mev);
+			} else {
+				ev.events = watchEvents(fd) | EPOLLONESHOT;
+				epoll_ctl(bgEpollFd, EPOLL_CTL_MOD, fd, &ev);
+			}
+		}
+
+		pthread_mutex_unlock(&bgLock[fd]);
+	}
+
+	return 0;
+}
+
+static bool initBgThreads()
+{
+	if (bgEpollFd != -1) return bgThreadNum;
+
+	bgEpollFd = epoll_create(NR_EPOLL_FDS);
+	fcntl(bgEpollFd, F_SETFD, fcntl(bgEpollFd, F_GETFD) | FD_CLOEXEC);
+
+	for (u32 i = 0; i < NR_FDS; i++) {
+		pthread_mutex_init(&bgLock[i], 0);
+	}
+
+	u32 num = 2;
+	Config::instance()->getOption("parse-threads", num);
+	if (num > MAX_BG_THREADS) num = MAX_BG_THREADS;
+
+	// signals are handled by the main thread only
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (bgThreadNum = 0; bgThreadNum < num; bgThreadNum++) {
+		if (pthread_create(&bgThreads[bgThreadNum], 0, bgThreadEntry, 0)) break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+	return bgThreadNum;
+}
+
+static void endBgThreads()
+{
+	if (bgEpollFd == -1) return;
+
+	// a pipe that is always readable wakes every thread, its negative tag tells them to quit
+	s32 fds[2];
+	if (bgThreadNum && !pipe(fds)) {
+		epoll_event ev;
+		ev.data.fd = -1;
+		ev.events = EPOLLIN;
+		epoll_ctl(bgEpollFd, EPOLL_CTL_ADD, fds[0], &ev);
+		s32 ret = write(fds[1], "", 1);
+
+		for (u32 i = 0; i < bgThreadNum; i++) {
+			pthread_join(bgThreads[i], 0);
+		}
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	close(bgEpollFd);
+}
+#endif
+
 IoDispatcher *IoDispatcher::createInstance()
 {
 	return new FbIoDispatcher();
@@ -53,6 +195,23 @@ FbIoDispatcher::FbIoDispatcher()
 
 FbIoDispatcher::~FbIoDispatcher()
 {
+	bool verbose = false;
+	Config::instance()->getOption("verbose", verbose);
+
+	static const s8 *names[NR_PRIOS] = { "input", "active shell", "background shells" };
+	for (u32 i = 0; verbose && i < NR_PRIOS; i++) {
+		if (!latency[i].events) continue;
+		printf("[io] %s: %u events, latency avg %lluus, max %lluus\n", names[i], latency[i].events,
+			latency[i].total / latency[i].events, latency[i].max);
+	}
+
+#ifdef HAVE_EPOLL
+	for (u32 i = NR_FDS; i--;) {
+		if (ioPipeMap[i]) setBackground(ioPipeMap[i], false);
+	}
+	endBgThreads();
+#endif
+
 	for (u32 i = NR_FDS; i--;) {
 		if (ioPipeMap[i]) delete ioPipeMap[i];
 	}
@@ -62,15 +221,50 @@ FbIoDispatcher::~FbIoDispatcher()
 #endif
 }
 
+// apply the watched events of a source already added. one handed to the background threads
+// is re-armed with them, unless a thread is handling it and re-arms it when done
+static void updateEvents(s32 fd)
+{
+#ifdef HAVE_EPOLL
+	epoll_event ev;
+	ev.data.fd = fd;
+	ev.events = watchEvents(fd);
+
+	if (!bgSource[fd]) {
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+	} else if (bgHandling != fd) {
+		ev.events |= EPOLLONESHOT;
+		epoll_ctl(bgEpollFd, EPOLL_CTL_MOD, fd, &ev);
+	}
+#else
+	if (readPaused[fd]) FD_CLR(fd, &fds);
+	else FD_SET(fd, &fds);
+
+	if (writeWatch[fd]) FD_SET(fd, &wfds);
+	else FD_CLR(fd, &wfds);
+#endif
+}
+
 void FbIoDispatcher::addIoSource(IoPipe *src, bool isread)
 {
 	if (src->fd() >= NR_FDS) return;
+
+	if (!isread) {
+		__atomic_store_n(&writeWatch[src->fd()], true, __ATOMIC_RELAXED);
+		updateEvents(src->fd());
+		return;
+	}
+
 	ioPipeMap[src->fd()] = src;
+	ioPriority[src->fd()] = PrioInput;
+	bgDeficit[src->fd()] = 0;
+	readySince[src->fd()] = 0;
+	writeWatch[src->fd()] = readPaused[src->fd()] = false;
 
 #ifdef HAVE_EPOLL
 	epoll_event ev;
 	ev.data.fd = src->fd();
-	ev.events = (isread ? EPOLLIN : EPOLLOUT);
+	ev.events = EPOLLIN;
 	epoll_ctl(epollFd, EPOLL_CTL_ADD, src->fd(), &ev);
 #else
 	FD_SET(src->fd(), &fds);
@@ -81,52 +275,166 @@ void FbIoDispatcher::addIoSource(IoPipe *src, bool isread)
 void FbIoDispatcher::removeIoSource(IoPipe *src, bool isread)
 {
 	if (src->fd() >= NR_FDS) return;
+
+	if (!isread) {
+		__atomic_store_n(&writeWatch[src->fd()], false, __ATOMIC_RELAXED);
+		updateEvents(src->fd());
+		return;
+	}
+
+	setBackground(src, false);
 	ioPipeMap[src->fd()] = 0;
 
 #ifdef HAVE_EPOLL
 	epoll_event ev;
 	ev.data.fd = src->fd();
-	ev.events = (isread ? EPOLLIN : EPOLLOUT);
+	ev.events = EPOLLIN;
 	epoll_ctl(epollFd, EPOLL_CTL_DEL, src->fd(), &ev);
 #else
 	FD_CLR(src->fd(), &fds);
+	FD_CLR(src->fd(), &wfds);
+#endif
+}
+
+void FbIoDispatcher::pauseRead(IoPipe *src, bool pause)
+{
+	s32 fd = src->fd();
+	if (fd < 0 || fd >= NR_FDS || ioPipeMap[fd] != src) return;
+
+	__atomic_store_n(&readPaused[fd], pause, __ATOMIC_RELAXED);
+	updateEvents(fd);
+}
+
+void FbIoDispatcher::setPriority(IoPipe *src, Priority prio)
+{
+	s32 fd = src->fd();
+	if (fd < 0 || fd >= NR_FDS || ioPipeMap[fd] != src) return;
+
+	ioPriority[fd] = prio;
+	bgDeficit[fd] = 0;
+}
+
+void FbIoDispatcher::setBackground(IoPipe *src, bool bg)
+{
+#ifdef HAVE_EPOLL
+	s32 fd = src->fd();
+	if (fd < 0 || fd >= NR_FDS || ioPipeMap[fd] != src || bgSource[fd] == bg) return;
+	if (bg && !initBgThreads()) return;
+
+	epoll_event ev;
+	ev.data.fd = fd;
+
+	if (bg) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &ev);
+
+		pthread_mutex_lock(&bgLock[fd]);
+		bgSource[fd] = true;
+		ev.events = watchEvents(fd) | EPOLLONESHOT;
+		epoll_ctl(bgEpollFd, EPOLL_CTL_ADD, fd, &ev);
+		pthread_mutex_unlock(&bgLock[fd]);
+	} else {
+		// waits for a background thread still handling the source
+		pthread_mutex_lock(&bgLock[fd]);
+		if (bgSource[fd]) {
+			bgSource[fd] = false;
+			epoll_ctl(bgEpollFd, EPOLL_CTL_DEL, fd, &ev);
+
+			ev.events = watchEvents(fd);
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+		}
+		pthread_mutex_unlock(&bgLock[fd]);
+	}
 #endif
 }
 
 void FbIoDispatcher::poll()
 {
+	// ready sources as fd with EPOLLIN/EPOLLOUT/EPOLLHUP style flags, fd is set to -1 once handled
+	enum { In = 1, Out = 2, Hup = 4 };
+	s32 readyFd[NR_FDS];
+	u8 readyFlags[NR_FDS];
+	u32 num = 0;
+
 #ifdef HAVE_EPOLL
-	epoll_event evs[NR_EPOLL_FDS];
-	s32 nfds = epoll_wait(epollFd, evs, NR_EPOLL_FDS, -1);
+	epoll_event evs[NR_FDS];
+	s32 nfds = epoll_wait(epollFd, evs, NR_FDS, -1);
 
 	for (s32 i = 0; i < nfds; i++) {
-		IoPipe *src = ioPipeMap[evs[i].data.fd];
-		if (!src) continue;
+		readyFd[num] = evs[i].data.fd;
+		readyFlags[num] = ((evs[i].events & EPOLLIN) ? In : 0) | ((evs[i].events & (EPOLLOUT | EPOLLERR)) ? Out : 0)
+			| ((evs[i].events & EPOLLHUP) ? Hup : 0);
+		num++;
+	}
+#else
+	fd_set rfds = fds, wset = wfds;
+	s32 nfds = select(maxfd + 1, &rfds, &wset, 0, 0);
 
-		if (evs[i].events & EPOLLIN) {
-			src->ready(true);
+	for (u32 i = 0; nfds > 0 && i <= maxfd; i++) {
+		if (FD_ISSET(i, &rfds) || FD_ISSET(i, &wset)) {
+			readyFd[num] = i;
+			readyFlags[num] = (FD_ISSET(i, &rfds) ? In : 0) | (FD_ISSET(i, &wset) ? Out : 0);
+			num++;
 		}
+	}
+#endif
 
-		if (evs[i].events & EPOLLOUT) {
-			src->ready(false);
-		}
+	if (!num) return;
+
+	u64 start = now();
+	bool bgReady[NR_FDS] = { false };
+	u32 bgNum = 0;
+
+	for (u32 i = 0; i < num; i++) {
+		s32 fd = readyFd[i];
+		if (!readySince[fd]) readySince[fd] = start;
 
-		if (evs[i].events & EPOLLHUP) {
-			delete src;
+		if (ioPriority[fd] == PrioBackground) {
+			bgReady[fd] = true;
+			bgNum++;
 		}
 	}
-#else
-	fd_set rfds = fds;
-	s32 num = select(maxfd + 1, &rfds, 0, 0, 0);
-	if (num <= 0) return;
-
-	for (u32 i = 0; i <= maxfd; i++) {
-		if (FD_ISSET(i, &rfds)) {
-			if (ioPipeMap[i]) {
-				ioPipeMap[i]->ready(true);
+
+	// a background source with nothing to read loses its remaining deficit
+	for (u32 fd = 0; fd < NR_FDS; fd++) {
+		if (!bgReady[fd]) bgDeficit[fd] = 0;
+	}
+
+	u32 quantum = BG_BUDGET / (bgNum ? bgNum : 1);
+
+	for (u32 prio = 0; prio < NR_PRIOS; prio++) {
+		for (u32 i = 0; i < num; i++) {
+			s32 fd = readyFd[i];
+			if (fd < 0 || ioPriority[fd] != prio) continue;
+
+			IoPipe *src = ioPipeMap[fd];
+			if (!src) continue;
+
+			if (prio == PrioBackground && !(readyFlags[i] & Hup)) {
+				bgDeficit[fd] += quantum;
+				if (bgDeficit[fd] <= 0) continue;
+			}
+
+			readyFd[i] = -1;
+
+			u64 wait = now() - readySince[fd];
+			readySince[fd] = 0;
+
+			latency[prio].events++;
+			latency[prio].total += wait;
+			if (wait > latency[prio].max) latency[prio].max = wait;
+
+			if (readyFlags[i] & In) {
+				u32 len = src->ready(true);
+				if (prio == PrioBackground) bgDeficit[fd] -= len;
+			}
+
+			if (readyFlags[i] & Out) {
+				src->ready(false);
+			}
+
+			if (readyFlags[i] & Hup) {
+				delete src;
 			}
-			if (!--num) break;
 		}
 	}
-#endif
 }
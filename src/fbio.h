@@ -25,7 +25,18 @@
 
 class FbIoDispatcher : public IoDispatcher {
 public:
+	// ready sources are served in this order each iteration
+	typedef enum { PrioInput = 0, PrioActive, PrioBackground, NR_PRIOS } Priority;
+
 	void poll();
+	void setPriority(IoPipe *src, Priority prio);
+
+	// hand a source to the background threads or take it back to the main loop,
+	// taking it back waits until a background thread has finished with it
+	void setBackground(IoPipe *src, bool bg);
+
+	// stop reading a source until it's resumed, its data waits in the kernel meanwhile
+	void pauseRead(IoPipe *src, bool pause);
 
 private:
 	friend class IoDispatcher;
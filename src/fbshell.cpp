@@ -35,10 +35,18 @@
 #include "fbterm.h"
 #include "font.h"
 #include "input.h"
+#include "worker.h"
+#include "pipeline.h"
+#include "fbio.h"
 
 #define screen (Screen::instance())
 #define manager (FbShellManager::instance())
 
+// fewest text rows worth handing to a rendering thread
+#define MIN_BAND_ROWS 4
+
+static RenderPipeline *pipeline;
+
 static const Color defaultPalette[NR_COLORS] = {
 	{0x00, 0x00, 0x00}, /* 0 */
 	{0xaa, 0x00, 0x00}, /* 1 */
@@ -347,21 +355,41 @@ void Shell::initWordChars(s8 *buf, u32 len)
 FbShell::FbShell()
 {
 	mImProxy = 0;
+	mBanded = false;
 	mPaletteChanged = false;
 	mPalette = 0;
+	mSurface = 0;
+	mDamagedRows = 0;
+	mSurfaceValid = false;
+	mSurfaceAge = 0;
+
+	static bool pipelineInited = false;
+	if (!pipelineInited) {
+		pipelineInited = true;
+		pipeline = RenderPipeline::instance();
+	}
+
 	Config::instance()->getOption("term-is-linux", mTermIsLinux);
 	createShellProcess(Config::instance()->getShellCommand());
 	resize(screen->cols(), screen->rows());
 
 	firstShell = false;
+
+	// stays in background until the manager activates it
+	parseInBackground(true);
 }
 
 FbShell::~FbShell()
 {
+	parseInBackground(false);
+	RenderPipeline::sync();
+
 	if (mImProxy) delete mImProxy;
 
 	manager->shellExited(this);
 	if (mPalette) delete[] mPalette;
+	if (mSurface) delete[] mSurface;
+	if (mDamagedRows) delete[] mDamagedRows;
 }
 
 void FbShell::drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws)
@@ -371,15 +399,36 @@ void FbShell::drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars,
 	adjustCharAttr(attr);
 	screen->drawText(FW(x), FH(y), attr.fcolor, attr.bcolor, num, chars, dws);
 
-	if (mImProxy) {
+	if (mImProxy && !mBanded) {
 		Rectangle rect = { FW(x), FH(y), FW(w), FH(1) };
 		mImProxy->redrawImWin(rect);
 	}
 }
 
+void FbShell::clearChars(CharAttr attr, u16 x, u16 y, u16 w, u16 h)
+{
+	if (manager->activeShell() != this) return;
+
+	adjustCharAttr(attr);
+	screen->fillRect(FW(x), FH(y), FW(w), FH(h), attr.bcolor);
+
+	if (mImProxy && !mBanded) {
+		Rectangle rect = { FW(x), FH(y), FW(w), FH(h) };
+		mImProxy->redrawImWin(rect);
+	}
+}
+
 bool FbShell::moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h)
 {
-	if (manager->activeShell() != this) return true;
+	if (manager->activeShell() != this) {
+		damageRows(dy, h);
+		return true;
+	}
+
+	// the render thread paints from snapshots, video memory may be behind the text buffer
+	if (pipelined()) return false;
+
+	RenderPipeline::sync();
 	return screen->move(sx, sy, dx, dy, w, h);
 }
 
@@ -394,7 +443,8 @@ void FbShell::drawCursor(CharAttr attr, u16 x, u16 y, u16 c)
 	mCursor.code = c;
 	mCursor.showed = false;
 
-	updateCursor();
+	if (pipelined()) mCursor.showed = true;
+	else updateCursor();
 
 	if (manager->activeShell() == this && (oldX != x || oldY != y)) {
 		reportCursor();
@@ -406,6 +456,17 @@ void FbShell::updateCursor()
 	if (manager->activeShell() != this || mCursor.x >= w() || mCursor.y >= h()) return;
 	mCursor.showed ^= true;
 
+	if (pipelined()) {
+		pipeline->publish(this);
+		return;
+	}
+
+	RenderPipeline::sync();
+	paintCursor(mCursor, cursorShape());
+}
+
+u16 FbShell::cursorShape()
+{
 	u16 shape = mode(CursorShape);
 	if (shape == CurDefault) {
 		static bool inited = false;
@@ -421,32 +482,39 @@ void FbShell::updateCursor()
 		shape = default_shape;
 	}
 
+	return shape;
+}
+
+void FbShell::paintCursor(const Cursor &cursor, u16 shape)
+{
+	if (manager->activeShell() != this || cursor.x >= w() || cursor.y >= h()) return;
+
 	switch (shape) {
 	case CurNone:
 		break;
 
 	case CurUnderline:
-		screen->fillRect(FW(mCursor.x), FH(mCursor.y + 1) - 1, FW(1), 1, mCursor.showed ? mCursor.attr.fcolor : mCursor.attr.bcolor);
+		screen->fillRect(FW(cursor.x), FH(cursor.y + 1) - 1, FW(1), 1, cursor.showed ? cursor.attr.fcolor : cursor.attr.bcolor);
 		if (mImProxy) {
-			Rectangle rect = { FW(mCursor.x), FH(mCursor.y + 1) - 1, FW(1), 1 };
+			Rectangle rect = { FW(cursor.x), FH(cursor.y + 1) - 1, FW(1), 1 };
 			mImProxy->redrawImWin(rect);
 		}
 		break;
 
 	default: {
-		bool dw = (mCursor.attr.type != CharAttr::Single);
+		bool dw = (cursor.attr.type != CharAttr::Single);
 
-		u16 x = mCursor.x;
-		if (mCursor.attr.type == CharAttr::DoubleRight) x--;
+		u16 x = cursor.x, code = cursor.code;
+		if (cursor.attr.type == CharAttr::DoubleRight) x--;
 
-		CharAttr attr = mCursor.attr;
-		if (mCursor.showed) {
+		CharAttr attr = cursor.attr;
+		if (cursor.showed) {
 			u8 temp = attr.fcolor;
 			attr.fcolor = attr.bcolor;
 			attr.bcolor = temp;
 		}
 
-		drawChars(attr, x, mCursor.y, dw ? FW(2) : FW(1), 1, &mCursor.code, &dw);
+		drawChars(attr, x, cursor.y, dw ? FW(2) : FW(1), 1, &code, &dw);
 		break;
 	}
 	}
@@ -511,6 +579,7 @@ void FbShell::modeChanged(ModeType type)
 void FbShell::request(RequestType type,  u32 val)
 {
 	bool active = (manager->activeShell() == this);
+	if (active) RenderPipeline::sync();
 
 	switch (type) {
 	case PaletteSet:
@@ -523,6 +592,9 @@ void FbShell::request(RequestType type,  u32 val)
 			memcpy(mPalette, defaultPalette, sizeof(defaultPalette));
 		}
 
+		// saved pixels were packed with the old colors
+		mSurfaceValid = false;
+
 		mPalette[val >> 24].red = (val >> 16) & 0xff;
 		mPalette[val >> 24].green = (val >> 8) & 0xff;
 		mPalette[val >> 24].blue = val & 0xff;
@@ -535,6 +607,7 @@ void FbShell::request(RequestType type,  u32 val)
 	case PaletteClear:
 		if (!mPaletteChanged) break;
 		mPaletteChanged = false;
+		mSurfaceValid = false;
 
 		if (active) {
 			screen->setPalette(defaultPalette);
@@ -553,6 +626,8 @@ static s32 tty0_fd = -1;
 
 void FbShell::switchVt(bool enter, FbShell *peer)
 {
+	RenderPipeline::sync();
+
 	if (tty0_fd == -1) tty0_fd = open("/dev/tty0", O_RDWR);
 	if (tty0_fd != -1) {
 		seteuid(0);
@@ -661,6 +736,8 @@ void FbShell::mouseInput(u16 x, u16 y, s32 type, s32 buttons)
 		u16 code = charCode(x, y);
 
 		if (attr.type == CharAttr::DoubleRight) x--;
+
+		RenderPipeline::sync();
 		screen->drawText(FW(x), FH(y), attr.bcolor, attr.fcolor, 1, &code, &dw);
 
 		mMousePointer.x = x;
@@ -669,12 +746,42 @@ void FbShell::mouseInput(u16 x, u16 y, s32 type, s32 buttons)
 	}
 
 	Shell::mouseInput(x, y, type, buttons);
+	flushUpdate();
 }
 
 void FbShell::readyRead(s8 *buf, u32 len)
 {
 	clearMousePointer();
 	Shell::readyRead(buf, len);
+	flushUpdate();
+}
+
+// text from the input method waits in its socket while the program isn't reading what it was
+// sent before. shells with one aren't parsed in the background, this runs in the main thread
+void FbShell::writeBacklog(bool full)
+{
+	if (mImProxy) ((FbIoDispatcher *)IoDispatcher::instance())->pauseRead(mImProxy, full);
+}
+
+void FbShell::parseInBackground(bool bg)
+{
+	FbIoDispatcher *io = (FbIoDispatcher *)IoDispatcher::instance();
+	io->setPriority(this, bg ? FbIoDispatcher::PrioBackground : FbIoDispatcher::PrioActive);
+
+	// input method messages are handled by the main loop, keep such shells there
+	if (bg && mImProxy) return;
+	io->setBackground(this, bg);
+}
+
+bool FbShell::pipelined()
+{
+	// input method windows are painted over the text synchronously, keep painting in this thread
+	return pipeline && manager->activeShell() == this && !mImProxy;
+}
+
+void FbShell::flushUpdate()
+{
+	if (pipelined()) pipeline->publish(this);
 }
 
 void FbShell::clearMousePointer()
@@ -687,7 +794,7 @@ void FbShell::clearMousePointer()
 
 void FbShell::expose(u16 x, u16 y, u16 w, u16 h)
 {
-	VTerm::expose(x, y, w, h);
+	render(x, y, w, h);
 
 	if (mode(CursorVisible) && mCursor.y >= y && mCursor.y < (y + h) && mCursor.x >= x && mCursor.x < (x + w)) {
 		mCursor.showed = false;
@@ -695,6 +802,60 @@ void FbShell::expose(u16 x, u16 y, u16 w, u16 h)
 	}
 }
 
+void FbShell::requestUpdate(u16 x, u16 y, u16 w, u16 h)
+{
+	if (manager->activeShell() != this) damageRows(y, h);
+	else if (pipelined()) pipeline->damage(y, h);
+	else render(x, y, w, h);
+}
+
+struct RenderJob {
+	FbShell *shell;
+	u16 x, y, w, h, rows;
+};
+
+void FbShell::renderBand(void *arg, u32 part)
+{
+	RenderJob *job = (RenderJob *)arg;
+
+	u16 y = job->y + part * job->rows;
+	u16 h = job->y + job->h - y;
+	if (h > job->rows) h = job->rows;
+
+	job->shell->VTerm::expose(job->x, y, job->w, h);
+}
+
+// split large updates into bands of text rows rendered in parallel, bands never share
+// pixels in video memory. input method windows are redrawn once all bands are done.
+void FbShell::render(u16 x, u16 y, u16 w, u16 h)
+{
+	// inactive shells paint nothing, and may be running in a background parsing thread
+	if (manager->activeShell() != this) return;
+
+	RenderPipeline::sync();
+
+	WorkerPool *pool = WorkerPool::instance();
+	u32 bands = h / MIN_BAND_ROWS;
+	if (bands > pool->threads()) bands = pool->threads();
+
+	if (bands < 2) {
+		VTerm::expose(x, y, w, h);
+		return;
+	}
+
+	RenderJob job = { this, x, y, w, h, (u16)((h + bands - 1) / bands) };
+	bands = (h + job.rows - 1) / job.rows;
+
+	mBanded = true;
+	pool->run(renderBand, &job, bands);
+	mBanded = false;
+
+	if (mImProxy) {
+		Rectangle rect = { FW(x), FH(y), FW(w), FH(h) };
+		mImProxy->redrawImWin(rect);
+	}
+}
+
 void FbShell::adjustCharAttr(CharAttr &attr)
 {
 	if (attr.italic) attr.fcolor = 2; // green
@@ -756,6 +917,7 @@ void FbShell::imInput(s8 *buf, u32 len)
 {
 	clearMousePointer();
 	Shell::keyInput(buf, len);
+	flushUpdate();
 }
 
 bool FbShell::childProcessExited(s32 pid)
@@ -772,3 +934,94 @@ bool FbShell::childProcessExited(s32 pid)
 
 	return false;
 }
+
+// fit the text to the screen again after the font was zoomed, called while the shell is
+// parsed by the main thread and paints nothing. pixels saved at the old size are useless
+void FbShell::fontChanged()
+{
+	if (mSurface) delete[] mSurface;
+	if (mDamagedRows) delete[] mDamagedRows;
+	mSurface = 0;
+	mDamagedRows = 0;
+	mSurfaceValid = false;
+
+	mCursor.showed = false;
+	mMousePointer.drawed = false;
+	resize(screen->cols(), screen->rows());
+
+	if (mImProxy) {
+		mImProxy->fontChanged();
+		reportCursor();
+	}
+}
+
+// may run in a background parsing thread, the row array is only freed while parsed by the main thread
+void FbShell::damageRows(u16 y, u16 h)
+{
+	if (!mDamagedRows) return;
+
+	for (; h-- && y < this->h(); y++) {
+		mDamagedRows[y] = true;
+	}
+}
+
+// keep the pixels of the page being switched away from, called before the shell becomes inactive
+bool FbShell::saveSurface()
+{
+	// input method windows are painted over the text
+	if (mImProxy) return false;
+
+	RenderPipeline::sync();
+
+	if (!mDamagedRows) mDamagedRows = new bool[screen->rows()];
+	memset(mDamagedRows, 0, sizeof(bool) * screen->rows());
+
+	// neither the cursor nor the mouse pointer belong to the saved page
+	damageRows(mCursor.y, 1);
+	if (mMousePointer.drawed) {
+		mMousePointer.drawed = false;
+		damageRows(mMousePointer.y, 1);
+	}
+
+	screen->savePage(mSurface);
+	mSurfaceValid = true;
+	return true;
+}
+
+// put the saved page back and repaint the rows changed meanwhile, false means a full redraw is needed
+bool FbShell::restoreSurface()
+{
+	if (!mSurface || !mSurfaceValid || mImProxy) return false;
+	mSurfaceValid = false;
+
+	u16 rows = h(), damaged = 0;
+	for (u16 y = 0; y < rows; y++) {
+		if (mDamagedRows[y]) damaged++;
+	}
+
+	// repainting most of the page costs as much as a redraw
+	if (damaged > rows / 2) return false;
+
+	RenderPipeline::sync();
+	screen->restorePage(mSurface);
+	if (pipeline) pipeline->adopt(this);
+
+	for (u16 y = 0; y < rows;) {
+		if (!mDamagedRows[y]) {
+			y++;
+			continue;
+		}
+
+		u16 num = 0;
+		for (; y + num < rows && mDamagedRows[y + num]; num++);
+
+		render(0, y, w(), num);
+		y += num;
+	}
+
+	mCursor.showed = false;
+	if (mCursor.y < rows && !mDamagedRows[mCursor.y]) render(mCursor.x, mCursor.y, 1, 1);
+	if (mode(CursorVisible)) updateCursor();
+
+	return true;
+}
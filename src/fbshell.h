@@ -34,26 +34,39 @@ public:
 	void imInput(s8 *buf, u32 len);
 	void ImExited() { mImProxy = 0; }
 	bool childProcessExited(s32 pid);
+	void flushUpdate();
+	void fontChanged();
 
 private:
 	friend class FbShellManager;
+	friend class RenderPipeline;
 	FbShell();
 	~FbShell();
 
 	virtual void drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws);
 	virtual bool moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h);
+	virtual void clearChars(CharAttr attr, u16 x, u16 y, u16 w, u16 h);
 	virtual void drawCursor(CharAttr attr, u16 x, u16 y, u16 c);
 	virtual void modeChanged(ModeType type);
 	virtual void request(RequestType type, u32 val = 0);
+	virtual void requestUpdate(u16 x, u16 y, u16 w, u16 h);
 
 	virtual void initShellProcess();
 	virtual void readyRead(s8 *buf, u32 len);
+	virtual void writeBacklog(bool full);
 
 	void switchVt(bool enter, FbShell *peer);
 	void adjustCharAttr(CharAttr &attr);
 	void enableCursor(bool enable);
 	void updateCursor();
 	void clearMousePointer();
+	bool pipelined();
+	void parseInBackground(bool bg);
+	void render(u16 x, u16 y, u16 w, u16 h);
+	static void renderBand(void *arg, u32 part);
+	void damageRows(u16 y, u16 h);
+	bool saveSurface();
+	bool restoreSurface();
 
 	void changeMode(ModeType type, u16 val);
 	void reportCursor();
@@ -70,6 +83,9 @@ private:
 		CharAttr attr;
 	} mCursor;
 
+	u16 cursorShape();
+	void paintCursor(const Cursor &cursor, u16 shape);
+
 	struct MousePointer {
 		MousePointer() {
 			drawed = false;
@@ -78,9 +94,16 @@ private:
 		bool drawed;
 	} mMousePointer;
 
+	bool mBanded;
 	bool mPaletteChanged;
 	struct Color *mPalette;
 	class ImProxy *mImProxy;
+
+	// pixels of the last visible page while inactive, rows changed since are in mDamagedRows
+	u8 *mSurface;
+	bool *mDamagedRows;
+	bool mSurfaceValid;
+	u32 mSurfaceAge;
 };
 
 #endif
@@ -25,6 +25,8 @@
 #include "screen.h"
 #include "improxy.h"
 #include "font.h"
+#include "pipeline.h"
+#include "fbconfig.h"
 
 #define screen (Screen::instance())
 #define SHELL_ANY ((FbShell *)-1)
@@ -38,6 +40,12 @@ FbShellManager::FbShellManager()
 	mCurShell = 0;
 	mActiveShell = 0;
 	memset(mShellList, 0, sizeof(mShellList));
+
+	u32 megabytes = 0;
+	Config::instance()->getOption("surface-memory", megabytes);
+	if (megabytes > 1024) megabytes = 1024;
+	mSurfaceMemory = megabytes << 20;
+	mSurfaceClock = 0;
 }
 
 FbShellManager::~FbShellManager()
@@ -74,7 +82,7 @@ void FbShellManager::switchShell(u32 num)
 	if (num >= NR_SHELLS) return;
 
 	mCurShell = num;
-	if (mVcCurrent && setActive(mShellList[mCurShell])) {
+	if (mVcCurrent && setActive(mShellList[mCurShell]) && (!mActiveShell || !mActiveShell->restoreSurface())) {
 		redraw(0, 0, screen->cols(), screen->rows());
 	}
 }
@@ -90,15 +98,66 @@ void FbShellManager::historyScroll(bool down)
 {
 	if (mActiveShell) {
 		mActiveShell->historyDisplay(false, down ? mActiveShell->h() : -mActiveShell->h());
+		mActiveShell->flushUpdate();
 	}
 }
 
+// font sizes are font-size plus or minus whole steps, so zooming back returns to sizes
+// whose glyphs are still cached. zooming in stops before the screen gets too few cells
+#define MIN_FONT_SIZE 6
+#define MIN_ZOOM_COLS 40
+#define MIN_ZOOM_ROWS 10
+
+void FbShellManager::zoom(bool in)
+{
+	Font *font = Font::instance();
+
+	u32 base = 12;
+	Config::instance()->getOption("font-size", base);
+
+	u32 step = base / 6;
+	if (!step) step = 1;
+
+	u32 old = font->size(), size = (in ? old + step : old - step);
+	if (!in && old < MIN_FONT_SIZE + step) return;
+
+	RenderPipeline::sync();
+	if (!font->setSize(size)) return;
+
+	if (in && (screen->width() / FW(1) < MIN_ZOOM_COLS || screen->height() / FH(1) < MIN_ZOOM_ROWS)) {
+		font->setSize(old);
+		return;
+	}
+
+	screen->fontChanged();
+	RenderPipeline::resize();
+
+	// shells are resized with none active, so nothing is painted before the whole screen is
+	FbShell *active = mActiveShell;
+	mActiveShell = 0;
+
+	for (u32 i = 0; i < NR_SHELLS; i++) {
+		FbShell *shell = mShellList[i];
+		if (!shell) continue;
+
+		if (shell != active) shell->parseInBackground(false);
+		shell->fontChanged();
+		if (shell != active) shell->parseInBackground(true);
+	}
+
+	mActiveShell = active;
+	if (mVcCurrent) redraw(0, 0, screen->cols(), screen->rows());
+}
+
 void FbShellManager::switchVc(bool enter)
 {
+	// nothing may be painted once the console is switched away
+	RenderPipeline::sync();
+
 	mVcCurrent = enter;
 	setActive(enter ? mShellList[mCurShell] : 0);
 
-	if (enter) {
+	if (enter && (!mActiveShell || !mActiveShell->restoreSurface())) {
 		redraw(0, 0, screen->cols(), screen->rows());
 	}
 }
@@ -142,14 +201,25 @@ u32 FbShellManager::getIndex(FbShell *shell, bool forward,  bool stepfirst)
 bool FbShellManager::setActive(FbShell *shell)
 {
 	if (mActiveShell == shell) return false;
+	RenderPipeline::sync();
+
+	// take the shell back from background parsing before it becomes active
+	if (shell) {
+		shell->parseInBackground(false);
+	}
 
 	if (mActiveShell) {
+		saveSurface(mActiveShell);
 		mActiveShell->switchVt(false, shell);
 	}
 
 	FbShell *oldActiveShell = mActiveShell;
 	mActiveShell = shell;
 
+	if (oldActiveShell) {
+		oldActiveShell->parseInBackground(true);
+	}
+
 	if (mActiveShell) {
 		mActiveShell->switchVt(true, oldActiveShell);
 	}
@@ -157,11 +227,53 @@ bool FbShellManager::setActive(FbShell *shell)
 	return true;
 }
 
+// keep the page of a shell being switched away from, within the surface-memory budget.
+// shells whose saved page went stale are evicted first, then the least recently saved.
+void FbShellManager::saveSurface(FbShell *shell)
+{
+	u32 size = screen->pageSize();
+	if (!size || size > mSurfaceMemory) return;
+
+	if (!shell->mSurface) {
+		u32 used = size;
+		for (u32 i = 0; i < NR_SHELLS; i++) {
+			if (mShellList[i] && mShellList[i]->mSurface) used += size;
+		}
+
+		while (used > mSurfaceMemory) {
+			FbShell *victim = 0;
+			for (u32 i = 0; i < NR_SHELLS; i++) {
+				FbShell *cur = mShellList[i];
+				if (!cur || !cur->mSurface) continue;
+
+				if (!victim || (victim->mSurfaceValid && (!cur->mSurfaceValid || cur->mSurfaceAge < victim->mSurfaceAge))) {
+					victim = cur;
+				}
+			}
+
+			delete[] victim->mSurface;
+			victim->mSurface = 0;
+			victim->mSurfaceValid = false;
+			used -= size;
+		}
+
+		shell->mSurface = new u8[size];
+	}
+
+	if (shell->saveSurface()) {
+		shell->mSurfaceAge = ++mSurfaceClock;
+	} else {
+		delete[] shell->mSurface;
+		shell->mSurface = 0;
+	}
+}
+
 void FbShellManager::redraw(u16 x, u16 y, u16 w, u16 h)
 {
 	if (mActiveShell) {
 		mActiveShell->expose(x, y, w, h);
 	} else {
+		RenderPipeline::sync();
 		screen->fillRect(FW(x), FH(y), FW(w), FH(h), 0);
 	}
 }
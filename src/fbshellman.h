@@ -41,6 +41,7 @@ public:
 
 	void drawCursor();
 	void historyScroll(bool down);
+	void zoom(bool in);
 	void redraw(u16 x, u16 y, u16 w, u16 h);
 	void switchVc(bool enter);
 	void childProcessExited(s32 pid);
@@ -48,11 +49,13 @@ public:
 private:
 	u32 getIndex(FbShell *shell, bool forward, bool stepfirst);
 	bool setActive(FbShell *shell);
+	void saveSurface(FbShell *shell);
 
 	#define NR_SHELLS 10
 	FbShell *mShellList[NR_SHELLS], *mActiveShell;
 	u32 mShellCount, mCurShell;
 	bool mVcCurrent;
+	u32 mSurfaceMemory, mSurfaceClock;
 };
 
 #endif
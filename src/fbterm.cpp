@@ -33,9 +33,12 @@
 #include "fbconfig.h"
 #include "fbio.h"
 #include "screen.h"
+#include "font.h"
 #include "input.h"
 #include "input_key.h"
 #include "mouse.h"
+#include "worker.h"
+#include "pipeline.h"
 
 #ifndef WAIT_ANY
 #define WAIT_ANY (-1)
@@ -106,13 +109,17 @@ FbTerm::FbTerm()
 
 FbTerm::~FbTerm()
 {
+	RenderPipeline::uninstance();
 	IoDispatcher::uninstance();
 	FbShellManager::uninstance();
+	WorkerPool::uninstance();
 	Screen::uninstance();
 }
 
 void FbTerm::init()
 {
+	// font discovery overlaps the tty setup, Screen waits for it
+	Font::preload();
 	if (!TtyInput::instance() || !Screen::instance()) return;
 
 	struct vt_mode vtm;
@@ -123,6 +130,10 @@ void FbTerm::init()
 	vtm.frsig = 0;
 	ioctl(STDIN_FILENO, VT_SETMODE, &vtm);
 
+	// the glyph statistics can be written while running, the tty is raw so it can't send SIGQUIT
+	s8 stats[8] = "";
+	Config::instance()->getOption("glyph-stats", stats, sizeof(stats));
+
 #ifdef HAVE_SIGNALFD
 	sigset_t sigmask;
 	sigemptyset(&sigmask);
@@ -133,6 +144,7 @@ void FbTerm::init()
 	sigaddset(&sigmask, SIGALRM);
 	sigaddset(&sigmask, SIGTERM);
 	sigaddset(&sigmask, SIGHUP);
+	if (stats[0]) sigaddset(&sigmask, SIGQUIT);
 
 	sigprocmask(SIG_BLOCK, &sigmask, &oldSigmask);
 	new SignalIo(sigmask);
@@ -145,6 +157,7 @@ void FbTerm::init()
 	signal(SIGALRM, sh);
 	signal(SIGTERM, sh);
 	signal(SIGHUP, sh);
+	if (stats[0]) signal(SIGQUIT, sh);
 #endif
 	signal(SIGPIPE, SIG_IGN);
 
@@ -195,6 +208,10 @@ void FbTerm::processSignal(u32 signo)
 		FbShellManager::instance()->drawCursor();
 		break;
 
+	case SIGQUIT:
+		Font::instance()->dumpStats();
+		break;
+
 	case SIGUSR1:
 		FbShellManager::instance()->switchVc(false);
 		Screen::instance()->switchVc(false);
@@ -274,6 +291,12 @@ void FbTerm::processSysKey(u32 key)
 		if (manager->activeShell()) {
 			manager->activeShell()->killIm();
 		}
+		break;
+
+	case CTRL_ALT_EQUAL:
+	case CTRL_ALT_MINUS:
+		manager->zoom(key == CTRL_ALT_EQUAL);
+		break;
 
 	default:
 		break;
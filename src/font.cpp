@@ -18,12 +18,29 @@
  *
  */
 
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <fontconfig/fontconfig.h>
 #include <ft2build.h>
 #include FT_GLYPH_H
 #include "font.h"
 #include "screen.h"
 #include "fbconfig.h"
+#include "vterm.h"
+#include "bitmapfont.h"
+#include "boxdraw.h"
 
 #define OFFSET(TYPE, MEMBER) ((size_t)(&(((TYPE *)0)->MEMBER)))
 #define SUBS(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
@@ -36,14 +53,249 @@ static FT_Library ftlib;
 static FT_Face *fontFaces;
 static u32 *fontFlags;
 
-static Font::Glyph **glyphCache;
-static bool *glyphCacheInited;
+static pthread_t sortThread;
+static bool sortStarted, sortDone;
+static FcPattern *sortPattern;
+static FcFontSet *sortedList;
+
+static BitmapFont *bitmapFont;
+static bool fallbackTried;
+static bool boxGlyphs = true;
+
+// glyphs are kept in slots of two sizes, for narrow and wide cells, carved from chunks
+// allocated as the cache grows up to the configured budget. slots are cache line aligned
+// with room for a vector after the last row, so SIMD loads stay inside the slot.
+#define SLOT_ALIGN 64
+#define SLOT_PAD 16
+#define CHUNK_SLOTS 64
+
+struct SlabClass {
+	u32 slotSize, slots, maxSlots;
+	u8 **chunks;
+	u32 *keys, *hashes, *aliases;
+	u8 *refs;
+	u32 *freeSlots, freeCount;
+	u32 hand;
+};
+
+// glyphs rendered while the cache is full and can't be evicted yet, freed on next eviction
+struct SpillGlyph {
+	SpillGlyph *next;
+	u32 pad[2];
+	Font::Glyph glyph;
+};
+
+// open addressed table of (unicode + 1) << 32 | class << 31 | slot, written under cacheLock and
+// read without locking. it has twice the entries the budget allows, so it never fills up.
+#define ENTRY_EMPTY 0ULL
+#define ENTRY_DEAD (~0ULL)
+#define SPILL_REF ((u32)-1)
+
+static u64 *glyphTable;
+static u32 tableBits, tableMask, tableDead;
+static SlabClass slabs[2];
+static u32 cacheBytes, cacheBudget;
+static SpillGlyph *spills;
+static bool evictPending;
+static u64 cacheHits, cacheMisses, cacheEvictions, cacheShared;
+
+// identical bitmaps are stored once: slots are found by content hash in shareTable, entries
+// are ref + 1, and the other code points drawn with a slot are chained from it as aliases.
+// both are only used under cacheLock, aliases are capped so the glyph table keeps free entries.
+#define SHARE_DEAD ((u32)-1)
+
+struct GlyphAlias {
+	u32 unicode, next;
+};
+
+static u32 *shareTable, shareDead;
+static GlyphAlias *aliasPool;
+static u32 aliasFree, aliasMax;
+static __thread u64 threadHits;
+
+// code point -> font face and FreeType glyph index, filled lazily under cacheLock. pages are
+// published with release stores, characters no font has are then found without locking.
+#define FACE_UNKNOWN 0xff
+#define FACE_MISSING 0xfe
+#define FACE_BITMAP 0xfd
+#define FACE_BOX 0xfc
+
+struct CharPage {
+	u8 faces[256];
+	u32 indexes[256];
+};
+
+static CharPage *charPages[0x110000 >> 8];
+
+// usage statistics for glyph-stats: draws of each code point in pages allocated on first use
+// and published with compare and swap, the time taken by renders in power of two microsecond
+// buckets, and how far down the font list characters were found. off unless a file is named.
+// the most recent draws are also kept in order in a ring, a cache policy can be replayed on them
+#define RENDER_BUCKETS 16
+#define DEPTH_BUCKETS 8
+#define TRACE_SIZE (1 << 20)
+#define TRACE_WIDE 0x80000000
+
+struct UsagePage {
+	u32 draws[256];
+	u8 wide[256];
+};
+
+static bool statsOn;
+static s8 statsFile[256];
+static UsagePage *usagePages[0x110000 >> 8];
+static u64 renderTimes[RENDER_BUCKETS];
+static u32 faceDepths[DEPTH_BUCKETS], missingChars, bitmapChars, boxChars;
+static u32 *traceDraws;
+static u64 traceCount;
+
+// glyphs can also be kept in a file shared by all instances using the same fonts, size and
+// rotation, named after a hash of these. it is mapped by each of them, new glyphs are appended
+// by reserving space with an atomic add and publishing an index entry with compare and swap.
+// entries are (unicode + 1) << 32 | file offset / 64, and never removed.
+#define DISK_MAGIC "FBTGLYF1"
+#define DISK_ALIGN 64
+
+struct DiskHeader {
+	s8 magic[8];
+	u64 key;
+	u32 size, entries, used, count;
+	u8 pad[32];
+};
+
+static DiskHeader *diskCache;
+static u64 *diskIndex;
+static u32 diskBits, diskMask, diskSize;
+static bool diskInited;
+
+// cell metrics, for rendering outside of Font
+static u32 cellWidth, cellHeight;
+static s32 cellBaseline;
+
+// pixel size faces are opened at, and the one the font list was matched with
+static u32 pixelSize, basePixels;
+
+// the state above depending on the pixel size is kept here for the sizes not in use, so
+// zooming back finds their faces and glyphs. the least recently used one is dropped for
+// a new size beyond MAX_SIZES
+#define MAX_SIZES 4
+
+struct SizeCache {
+	u32 pixelSize, lastUsed;
+	u32 cellWidth, cellHeight;
+	s32 cellBaseline;
+	FT_Face *faces;
+	u32 *flags;
+	u64 *glyphTable;
+	u32 tableBits, tableMask, tableDead;
+	SlabClass slabs[2];
+	u32 cacheBytes;
+	u32 *shareTable, shareDead;
+	GlyphAlias *aliasPool;
+	u32 aliasFree, aliasMax;
+	DiskHeader *diskCache;
+	u64 *diskIndex;
+	u32 diskBits, diskMask, diskSize;
+	bool diskInited;
+};
+
+static SizeCache sizeCaches[MAX_SIZES];
+static u32 sizeCount, curSize, sizeClock;
+
+// background threads render glyphs likely needed soon: a configured set at startup, and the
+// rest of a 256 code point page once a character of it is first drawn. each thread has its
+// own FreeType library and faces, and only takes cacheLock to look up and insert glyphs.
+#define MAX_PRERENDER_THREADS 8
+#define NR_RANGES 64
+
+struct GlyphRange {
+	u32 first, last;
+};
+
+static GlyphRange prerenderQueue[NR_RANGES];
+static u32 queueHead, queueTail;
+static pthread_t prerenderThreads[MAX_PRERENDER_THREADS];
+static u32 prerenderThreadNum;
+static bool prerenderInited, prerenderQuit;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueWake = PTHREAD_COND_INITIALIZER;
+
+// threads are held off while the size changes, faces opened for an older generation are closed
+static bool prerenderHold;
+static u32 prerenderBusy, prerenderGeneration;
+static pthread_cond_t queueIdle = PTHREAD_COND_INITIALIZER;
+
+// readers holding glyph pointers, or EVICTING while unused glyphs are being freed
+#define EVICTING 0x80000000
+static u32 glyphReaders;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
 
 static void openFont(u32 index);
+static FT_Face loadFace(FT_Library lib, FcPattern *pattern, u32 &flags);
+static u32 loadFlags(FcPattern *pattern);
+static double patternSize(FcPattern *pattern);
+static void prerender(u32 first, u32 last);
+static void queueConfigured();
+static void *prerenderEntry(void *arg);
+static void evictGlyphs();
+static void freeCache();
+static void loadSize(const SizeCache &size);
+static bool loadFontList(u32 pixel_size);
+static void *sortFonts(void *arg);
+static void resolveFonts();
 
 DEFINE_INSTANCE(Font)
 
+// fonts are looked up in a thread started by preload while the tty is set up, the
+// first instance() call takes the result
+static pthread_t preloadThread;
+static bool preloading;
+static Font *preloadedFont;
+
+void Font::preload()
+{
+	if (!pthread_create(&preloadThread, 0, preloadEntry, 0)) preloading = true;
+}
+
+void *Font::preloadEntry(void *arg)
+{
+	preloadedFont = loadFont();
+	return 0;
+}
+
 Font *Font::createInstance()
+{
+	if (!preloading) return loadFont();
+
+	preloading = false;
+	pthread_join(preloadThread, 0);
+	return preloadedFont;
+}
+
+Font *Font::loadFont()
+{
+	u32 pixel_size = 12;
+	Config::instance()->getOption("font-size", pixel_size);
+	if (!pixel_size) pixel_size = 12;
+	pixelSize = basePixels = pixel_size;
+
+	s8 name[128];
+	Config::instance()->getOption("font-file", name, sizeof(name));
+
+	if (*name) {
+		bitmapFont = BitmapFont::load(name);
+		if (bitmapFont) return new Font();
+
+		fprintf(stderr, "can't load font file %s, using fontconfig fonts!\n", name);
+	}
+
+	if (!loadFontList(pixel_size)) return 0;
+	return new Font();
+}
+
+// only the best match of font-names is resolved at startup, the fallback fonts are sorted
+// by a thread meanwhile. with a bitmap font this is done once a character it hasn't is drawn
+static bool loadFontList(u32 pixel_size)
 {
 	FcInit();
 
@@ -51,9 +303,6 @@ Font *Font::createInstance()
 	Config::instance()->getOption("font-names", buf, sizeof(buf));
 
 	FcPattern *pat = FcNameParse((FcChar8 *)(*buf ? buf : "mono"));
-
-	u32 pixel_size = 12;
-	Config::instance()->getOption("font-size", pixel_size);
 	FcPatternAddDouble(pat, FC_PIXEL_SIZE, (double)pixel_size);
 
 	FcPatternAddString(pat, FC_LANG, (FcChar8 *)"en");
@@ -62,88 +311,150 @@ Font *Font::createInstance()
 	FcDefaultSubstitute(pat);
 
 	FcResult result;
-	FcFontSet *fs = FcFontSort(NULL, pat, FcTrue, &unicodeMap, &result);
+	FcPattern *match = FcFontMatch(NULL, pat, &result);
 
-	if (fs) {
-		fontList = FcFontSetCreate();
+	if (!match) {
+		FcPatternDestroy(pat);
+		FcFini();
+		return false;
+	}
 
-		FcObjectSet *family = FcObjectSetCreate();
-		FcObjectSetAdd(family, FC_FAMILY);
+	fontList = FcFontSetCreate();
+	FcFontSetAdd(fontList, match);
 
-		for (u32 i = 0; i < fs->nfont; i++) {
-			FcPattern *font = FcFontRenderPrepare(NULL, pat, fs->fonts[i]);
-			if (!font) continue;
+	// face numbers are bytes, the list never grows beyond them
+	fontFaces = new FT_Face[FACE_BOX];
+	fontFlags = new u32[FACE_BOX];
+	memset(fontFaces, 0, sizeof(FT_Face) * FACE_BOX);
 
-			bool same = false;
-			for (u32 j = 0; j < fontList->nfont; j++) {
-				if (FcPatternEqualSubset(fontList->fonts[j], font, family)) {
-					same = true;
-					break;
-				}
-			}
+	FT_Init_FreeType(&ftlib);
 
-			if (same) {
-				FcPatternDestroy(font);
-			} else {
-				FcFontSetAdd(fontList, font);
+	// signals are handled by the main thread only
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	sortPattern = pat;
+	if (!pthread_create(&sortThread, 0, sortFonts, 0)) {
+		sortStarted = true;
+	} else {
+		sortFonts(0);
+		FcFontSetDestroy(fontList);
+		fontList = sortedList;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+	return true;
+}
+
+// the whole list of fonts matching font-names, one per family, the best match first.
+// families are compared before FcFontRenderPrepare, so only kept fonts are prepared
+static void *sortFonts(void *arg)
+{
+	FcPattern *primary = fontList->fonts[0];
+
+	FcResult result;
+	FcFontSet *fs = FcFontSort(NULL, sortPattern, FcTrue, &unicodeMap, &result);
+
+	FcFontSet *list = FcFontSetCreate();
+	FcPatternReference(primary);
+	FcFontSetAdd(list, primary);
+
+	FcChar8 *families[FACE_BOX];
+	families[0] = (FcChar8 *)"";
+	FcPatternGetString(primary, FC_FAMILY, 0, &families[0]);
+
+	for (u32 i = 0; fs && i < fs->nfont && list->nfont < FACE_BOX; i++) {
+		FcChar8 *family = (FcChar8 *)"";
+		FcPatternGetString(fs->fonts[i], FC_FAMILY, 0, &family);
+
+		bool same = false;
+		for (u32 j = 0; j < list->nfont; j++) {
+			if (!FcStrCmpIgnoreCase(families[j], family)) {
+				same = true;
+				break;
 			}
 		}
 
-		FcObjectSetDestroy(family);
+		if (same) continue;
+
+		FcPattern *font = FcFontRenderPrepare(NULL, sortPattern, fs->fonts[i]);
+		if (!font) continue;
+
+		families[list->nfont] = family;
+		FcFontSetAdd(list, font);
 	}
 
-	FcPatternDestroy(pat);
 	if (fs) FcFontSetDestroy(fs);
+	FcPatternDestroy(sortPattern);
+	sortPattern = 0;
 
-	if (fontList && fontList->nfont) return new Font();
-
-	if (unicodeMap) FcCharSetDestroy(unicodeMap);
-	if (fontList) FcFontSetDestroy(fontList);
-	FcFini();
+	sortedList = list;
+	__atomic_store_n(&sortDone, true, __ATOMIC_RELEASE);
 	return 0;
 }
 
+// wait for the sorted font list and switch to it, the best match keeps face number 0.
+// called under cacheLock, fontList is only read under it once glyphs are rendered
+static void resolveFonts()
+{
+	if (!sortStarted) return;
+
+	sortStarted = false;
+	pthread_join(sortThread, 0);
+
+	FcFontSetDestroy(fontList);
+	fontList = sortedList;
+}
+
 Font::Font()
 {
-	mHeight = mWidth = 0;
+	sizeCount = 1;
+	sizeCaches[0].lastUsed = ++sizeClock;
 
-	fontFaces = new FT_Face[fontList->nfont];
-	fontFlags = new u32[fontList->nfont];
-	memset(fontFaces, 0, sizeof(FT_Face) * fontList->nfont);
+	initCell();
+	if (mWidth && mHeight) initCache();
+}
 
-	glyphCache = new Glyph *[256 * 256];
-	glyphCacheInited = new bool[256];
-	memset(glyphCacheInited, 0, sizeof(bool) * 256);
+// cell metrics of the current pixel size, mWidth stays 0 when the best match can't be opened.
+// forced sizes given as plain numbers are scaled when zoomed, relative ones are not
+void Font::initCell()
+{
+	mHeight = mWidth = 0;
 
-	FT_Init_FreeType(&ftlib);
-	openFont(0);
-
-	FT_Face face = fontFaces[0];
-	if (face == (FT_Face)-1) return;
-
-	if (face->face_flags & FT_FACE_FLAG_SCALABLE) {
-		mHeight = face->size->metrics.height >> 6;
-		mWidth = face->size->metrics.max_advance >> 6;
-	} else if (face->num_fixed_sizes) {
-		double dsize;
-		FcPatternGetDouble(fontList->fonts[0], FC_PIXEL_SIZE, 0, &dsize);
-
-		FT_Bitmap_Size *sizes = face->available_sizes;
-		u32 index = 0, diffmin = (u32)-1;
-		for (u32 i = 0; i < face->num_fixed_sizes; i++) {
-			u32 diff = SUBS(sizes[i].size >> 6, (u32)dsize);
-			if (diff < diffmin ) {
-				index = i;
-				diffmin = diff;
+	if (bitmapFont) {
+		mWidth = bitmapFont->width();
+		mHeight = bitmapFont->height();
+		mBaseline = bitmapFont->baseline();
+	} else {
+		openFont(0);
+
+		FT_Face face = fontFaces[0];
+		if (face == (FT_Face)-1) return;
+
+		if (face->face_flags & FT_FACE_FLAG_SCALABLE) {
+			mHeight = face->size->metrics.height >> 6;
+			mWidth = face->size->metrics.max_advance >> 6;
+		} else if (face->num_fixed_sizes) {
+			double dsize = patternSize(fontList->fonts[0]);
+
+			FT_Bitmap_Size *sizes = face->available_sizes;
+			u32 index = 0, diffmin = (u32)-1;
+			for (u32 i = 0; i < face->num_fixed_sizes; i++) {
+				u32 diff = SUBS(sizes[i].size >> 6, (u32)dsize);
+				if (diff < diffmin ) {
+					index = i;
+					diffmin = diff;
+				}
 			}
+
+			mHeight = sizes[index].height;
+			mWidth = sizes[index].width;
 		}
+		mBaseline = face->size->metrics.ascender >> 6;
 
-		mHeight = sizes[index].height;
-		mWidth = sizes[index].width;
+		if (!(face->face_flags & FT_FACE_FLAG_FIXED_WIDTH)) mWidth = MIN(mWidth, (mHeight + 1) / 2);
 	}
-	mBaseline = face->size->metrics.ascender >> 6;
-
-	if (!(face->face_flags & FT_FACE_FLAG_FIXED_WIDTH)) mWidth = MIN(mWidth, (mHeight + 1) / 2);
 
 	u32 width = 0;
 	Config::instance()->getOption("font-width", width);
@@ -153,7 +464,7 @@ Font::Font()
 		Config::instance()->getOption("font-width", buf, sizeof(buf));
 
 		if (buf[0] == '+' || buf[0] == '-') mWidth += (s32)width;
-		else mWidth = width;
+		else mWidth = width * pixelSize / basePixels;
 	}
 
 	u32 height = 0;
@@ -164,7 +475,7 @@ Font::Font()
 		Config::instance()->getOption("font-height", buf, sizeof(buf));
 
 		if (buf[0] == '+' || buf[0] == '-') mHeight += (s32)height;
-		else mHeight = height;
+		else mHeight = height * pixelSize / basePixels;
 	}
 
 	u32 baseline = 0;
@@ -175,26 +486,157 @@ Font::Font()
 		Config::instance()->getOption("font-baseline", buf, sizeof(buf));
 
 		if (buf[0] == '+' || buf[0] == '-') mBaseline += (s32)baseline;
-		else mBaseline = baseline;
+		else mBaseline = baseline * pixelSize / basePixels;
+	}
+}
+
+void Font::initCache()
+{
+	cellWidth = mWidth;
+	cellHeight = mHeight;
+	cellBaseline = mBaseline;
+
+	Config::instance()->getOption("box-drawing", boxGlyphs);
+
+	Config::instance()->getOption("glyph-stats", statsFile, sizeof(statsFile));
+	statsOn = statsFile[0];
+
+	// initCache runs again on every zoom, the trace goes on across them
+	if (statsOn && !traceDraws) {
+		traceDraws = new u32[TRACE_SIZE];
+		traceCount = 0;
+	}
+
+	u32 megabytes = 4;
+	Config::instance()->getOption("glyph-cache-memory", megabytes);
+	if (megabytes > 1024) megabytes = 1024;
+	cacheBudget = megabytes << 20;
+
+	u32 cell = mWidth * mHeight;
+	for (u32 i = 0; i < 2; i++) {
+		SlabClass &c = slabs[i];
+		c.slotSize = (OFFSET(Glyph, pixmap) + cell * (i + 1) + SLOT_PAD + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+
+		// one chunk of each class is always allowed, even with a tiny budget
+		c.maxSlots = (cacheBudget / c.slotSize + CHUNK_SLOTS) & ~(CHUNK_SLOTS - 1);
+		c.slots = c.freeCount = c.hand = 0;
+		c.chunks = new u8 *[c.maxSlots / CHUNK_SLOTS];
+		c.keys = new u32[c.maxSlots];
+		c.hashes = new u32[c.maxSlots];
+		c.aliases = new u32[c.maxSlots];
+		c.refs = new u8[c.maxSlots];
+		c.freeSlots = new u32[c.maxSlots];
+	}
+
+	// narrow slots are the smallest, no more of them fit in the budget, plus a chunk of wide ones
+	for (tableBits = 8; (1U << tableBits) < 2 * (slabs[0].maxSlots + CHUNK_SLOTS); tableBits++);
+	tableMask = (1 << tableBits) - 1;
+	tableDead = 0;
+
+	glyphTable = new u64[tableMask + 1];
+	memset(glyphTable, 0, sizeof(u64) * (tableMask + 1));
+
+	shareTable = new u32[tableMask + 1];
+	memset(shareTable, 0, sizeof(u32) * (tableMask + 1));
+	shareDead = 0;
+
+	// live slots take at most half of the table and dead entries a quarter before a rebuild
+	aliasMax = (tableMask + 1) / 8;
+	aliasPool = new GlyphAlias[aliasMax + 1];
+	for (u32 i = 1; i <= aliasMax; i++) {
+		aliasPool[i].next = (i < aliasMax ? i + 1 : 0);
 	}
+	aliasFree = 1;
 }
 
 Font::~Font()
 {
-	for (u32 i = 0; i < 256; i++) {
-		if (!glyphCacheInited[i]) continue;
+	pthread_mutex_lock(&queueLock);
+	prerenderQuit = true;
+	pthread_cond_broadcast(&queueWake);
+	pthread_mutex_unlock(&queueLock);
 
-		for (u32 j = 0; j < 256; j++) {
-			if (glyphCache[i * 256 + j]) {
-				delete[] (u8 *)glyphCache[i * 256 + j];
-			}
+	for (u32 i = 0; i < prerenderThreadNum; i++) {
+		pthread_join(prerenderThreads[i], 0);
+	}
+
+	if (statsOn) dumpStats();
+
+	bool verbose = false;
+	Config::instance()->getOption("verbose", verbose);
+
+	if (verbose && glyphTable) {
+		printf("[font] glyph cache: %llu hits, %llu misses, %llu evictions, %llu shared, %uKB of %uKB used\n",
+			cacheHits, cacheMisses, cacheEvictions, cacheShared, cacheBytes >> 10, cacheBudget >> 10);
+	}
+
+	if (diskCache) {
+		if (verbose) {
+			printf("[font] glyph file: %u glyphs, %uKB of %uKB used\n", diskCache->count,
+				MIN(diskCache->used, diskSize) >> 10, diskSize >> 10);
+		}
+	}
+
+	// faces of the sorted fonts may be open
+	if (fontList) resolveFonts();
+
+	freeCache();
+	for (u32 i = 0; i < sizeCount; i++) {
+		if (i == curSize) continue;
+
+		loadSize(sizeCaches[i]);
+		freeCache();
+	}
+
+	for (u32 i = 0; i < sizeof(charPages) / sizeof(charPages[0]); i++) {
+		if (charPages[i]) delete charPages[i];
+		if (usagePages[i]) delete usagePages[i];
+	}
+
+	if (traceDraws) {
+		delete[] traceDraws;
+		traceDraws = 0;
+	}
+
+	if (bitmapFont) delete bitmapFont;
+	if (!fontList) return;
+
+	FT_Done_FreeType(ftlib);
+	if (unicodeMap) FcCharSetDestroy(unicodeMap);
+	FcFontSetDestroy(fontList);
+	FcFini();
+}
+
+// release the faces and glyphs of the current size
+static void freeCache()
+{
+	if (diskCache) munmap(diskCache, diskSize);
+
+	for (u32 i = 0; glyphTable && i < 2; i++) {
+		SlabClass &c = slabs[i];
+		for (u32 j = 0; j < c.slots / CHUNK_SLOTS; j++) {
+			free(c.chunks[j]);
 		}
+
+		delete[] c.chunks;
+		delete[] c.keys;
+		delete[] c.hashes;
+		delete[] c.aliases;
+		delete[] c.refs;
+		delete[] c.freeSlots;
+	}
+
+	while (spills) {
+		SpillGlyph *next = spills->next;
+		delete[] (u8 *)spills;
+		spills = next;
 	}
 
-	delete[] glyphCache;
-	delete[] glyphCacheInited;
+	delete[] glyphTable;
+	delete[] shareTable;
+	delete[] aliasPool;
 
-	for (u32 i = 0; i < fontList->nfont; i++) {
+	for (u32 i = 0; fontFaces && i < fontList->nfont; i++) {
 		if (fontFaces[i] && fontFaces[i] != (FT_Face)-1) {
 			FT_Done_Face(fontFaces[i]);
 		}
@@ -202,19 +644,180 @@ Font::~Font()
 
 	delete[] fontFaces;
 	delete[] fontFlags;
+}
 
-	FT_Done_FreeType(ftlib);
-	FcCharSetDestroy(unicodeMap);
-	FcFontSetDestroy(fontList);
-	FcFini();
+static void saveSize(SizeCache &size)
+{
+	size.pixelSize = pixelSize;
+	size.cellWidth = cellWidth;
+	size.cellHeight = cellHeight;
+	size.cellBaseline = cellBaseline;
+	size.faces = fontFaces;
+	size.flags = fontFlags;
+	size.glyphTable = glyphTable;
+	size.tableBits = tableBits;
+	size.tableMask = tableMask;
+	size.tableDead = tableDead;
+	size.slabs[0] = slabs[0];
+	size.slabs[1] = slabs[1];
+	size.cacheBytes = cacheBytes;
+	size.shareTable = shareTable;
+	size.shareDead = shareDead;
+	size.aliasPool = aliasPool;
+	size.aliasFree = aliasFree;
+	size.aliasMax = aliasMax;
+	size.diskCache = diskCache;
+	size.diskIndex = diskIndex;
+	size.diskBits = diskBits;
+	size.diskMask = diskMask;
+	size.diskSize = diskSize;
+	size.diskInited = diskInited;
+}
+
+static void loadSize(const SizeCache &size)
+{
+	pixelSize = size.pixelSize;
+	cellWidth = size.cellWidth;
+	cellHeight = size.cellHeight;
+	cellBaseline = size.cellBaseline;
+	fontFaces = size.faces;
+	fontFlags = size.flags;
+	glyphTable = size.glyphTable;
+	tableBits = size.tableBits;
+	tableMask = size.tableMask;
+	tableDead = size.tableDead;
+	slabs[0] = size.slabs[0];
+	slabs[1] = size.slabs[1];
+	cacheBytes = size.cacheBytes;
+	shareTable = size.shareTable;
+	shareDead = size.shareDead;
+	aliasPool = size.aliasPool;
+	aliasFree = size.aliasFree;
+	aliasMax = size.aliasMax;
+	diskCache = size.diskCache;
+	diskIndex = size.diskIndex;
+	diskBits = size.diskBits;
+	diskMask = size.diskMask;
+	diskSize = size.diskSize;
+	diskInited = size.diskInited;
+}
+
+// the prerendering threads finish their current glyph and wait, ranges queued for the old
+// size are dropped
+static void holdPrerender(bool hold)
+{
+	pthread_mutex_lock(&queueLock);
+	__atomic_store_n(&prerenderHold, hold, __ATOMIC_RELAXED);
+
+	if (hold) {
+		queueHead = queueTail;
+		while (prerenderBusy) pthread_cond_wait(&queueIdle, &queueLock);
+	} else {
+		prerenderGeneration++;
+		pthread_cond_broadcast(&queueWake);
+	}
+
+	pthread_mutex_unlock(&queueLock);
+}
+
+bool Font::setSize(u32 pixel_size)
+{
+	if (bitmapFont || !glyphTable || !pixel_size) return false;
+	if (pixel_size == pixelSize) return true;
+
+	holdPrerender(true);
+	pthread_mutex_lock(&cacheLock);
+
+	// nobody holds glyphs, spilled ones can go
+	if (evictPending) evictGlyphs();
+
+	u32 old = curSize, next = 0;
+	saveSize(sizeCaches[old]);
+
+	for (; next < sizeCount && sizeCaches[next].pixelSize != pixel_size; next++);
+
+	bool fresh = (next == sizeCount), failed = false;
+	if (fresh && sizeCount < MAX_SIZES) {
+		sizeCount++;
+	} else if (fresh) {
+		next = (old ? 0 : 1);
+		for (u32 i = 0; i < sizeCount; i++) {
+			if (i != old && sizeCaches[i].lastUsed < sizeCaches[next].lastUsed) next = i;
+		}
+
+		resolveFonts();
+		loadSize(sizeCaches[next]);
+		freeCache();
+	}
+
+	if (fresh) {
+		memset(&sizeCaches[next], 0, sizeof(SizeCache));
+		loadSize(sizeCaches[next]);
+
+		pixelSize = pixel_size;
+		fontFaces = new FT_Face[FACE_BOX];
+		fontFlags = new u32[FACE_BOX];
+		memset(fontFaces, 0, sizeof(FT_Face) * FACE_BOX);
+
+		initCell();
+
+		if (mWidth && mHeight) {
+			initCache();
+		} else {
+			// the fonts can't be opened at this size, its slot is given up
+			freeCache();
+			sizeCount--;
+			if (next != sizeCount) sizeCaches[next] = sizeCaches[sizeCount];
+			if (old == sizeCount) old = next;
+
+			next = old;
+			failed = true;
+		}
+	}
+
+	if (!fresh || failed) loadSize(sizeCaches[next]);
+	curSize = next;
+	sizeCaches[next].lastUsed = ++sizeClock;
+
+	mWidth = cellWidth;
+	mHeight = cellHeight;
+	mBaseline = cellBaseline;
+
+	pthread_mutex_unlock(&cacheLock);
+	holdPrerender(false);
+
+	if (failed) return false;
+
+	// a new size gets the configured set rendered ahead again
+	if (fresh) {
+		pthread_mutex_lock(&queueLock);
+		if (prerenderInited) queueConfigured();
+		pthread_cond_signal(&queueWake);
+		pthread_mutex_unlock(&queueLock);
+	}
+
+	return true;
+}
+
+u32 Font::size()
+{
+	return pixelSize;
 }
 
 void Font::showInfo(bool verbose)
 {
 	if (!verbose) return;
 
+	if (bitmapFont) {
+		printf("[font] width: %dpx, height: %dpx, file: %s\n", mWidth, mHeight, bitmapFont->name());
+		return;
+	}
+
 	printf("[font] width: %dpx, height: %dpx, ordered list: ", mWidth, mHeight);
 
+	pthread_mutex_lock(&cacheLock);
+	resolveFonts();
+
 	u32 index;
 	FcChar8 *family;
 	for (index = 0; index < fontList->nfont - 1; index++) {
@@ -224,14 +827,75 @@ void Font::showInfo(bool verbose)
 
 	FcPatternGetString(fontList->fonts[index], FC_FAMILY, 0, &family);
 	printf("%s\n", family);
+
+	pthread_mutex_unlock(&cacheLock);
+}
+
+void Font::dumpStats()
+{
+	if (!statsOn || !glyphTable) return;
+
+	FILE *file = fopen(statsFile, "w");
+	if (!file) return;
+
+	pthread_mutex_lock(&cacheLock);
+
+	fprintf(file, "# fbterm glyph statistics, read by glyphstat\n");
+	fprintf(file, "cell %u %u\n", cellWidth, cellHeight);
+	fprintf(file, "slots %u %u\n", slabs[0].slotSize, slabs[1].slotSize);
+	fprintf(file, "budget %u\n", cacheBudget);
+	fprintf(file, "hits %llu\nmisses %llu\nevictions %llu\nshared %llu\n", cacheHits, cacheMisses, cacheEvictions, cacheShared);
+	fprintf(file, "resident %u\n", cacheBytes);
+	fprintf(file, "disk %u\n", diskCache ? MIN(diskCache->used, diskSize) : 0);
+
+	// bucket n counts renders taking less than 2^n microseconds
+	for (u32 i = 0; i < RENDER_BUCKETS; i++) {
+		if (renderTimes[i]) fprintf(file, "render %u %llu\n", i, renderTimes[i]);
+	}
+
+	for (u32 i = 0; i < DEPTH_BUCKETS; i++) {
+		if (faceDepths[i]) fprintf(file, "face %u %u\n", i, faceDepths[i]);
+	}
+	fprintf(file, "face missing %u\nface bitmap %u\nface box %u\n", missingChars, bitmapChars, boxChars);
+
+	// characters no font has never take cache space, they are left out
+	for (u32 i = 0; i < sizeof(usagePages) / sizeof(usagePages[0]); i++) {
+		UsagePage *page = __atomic_load_n(&usagePages[i], __ATOMIC_ACQUIRE);
+		if (!page) continue;
+
+		for (u32 c = 0; c < 256; c++) {
+			u32 draws = __atomic_load_n(&page->draws[c], __ATOMIC_RELAXED);
+			if (charPages[i] && charPages[i]->faces[c] == FACE_MISSING) continue;
+			if (draws) fprintf(file, "glyph %x %u %u\n", (i << 8) | c, draws, __atomic_load_n(&page->wide[c], __ATOMIC_RELAXED) ? 2 : 1);
+		}
+	}
+
+	// the draws in order, oldest first, once the ring wrapped only the last TRACE_SIZE of them
+	u64 count = __atomic_load_n(&traceCount, __ATOMIC_RELAXED);
+	u64 start = (count > TRACE_SIZE ? count - TRACE_SIZE : 0);
+	for (u64 n = start; n < count; n++) {
+		u32 draw = __atomic_load_n(&traceDraws[n & (TRACE_SIZE - 1)], __ATOMIC_RELAXED);
+		if ((n - start) % 16 == 0) fprintf(file, "%strace", n == start ? "" : "\n");
+		fprintf(file, (draw & TRACE_WIDE) ? " %x:2" : " %x", draw & ~TRACE_WIDE);
+	}
+	if (count > start) fprintf(file, "\n");
+
+	pthread_mutex_unlock(&cacheLock);
+	fclose(file);
 }
 
 static void openFont(u32 index)
 {
 	if (index >= fontList->nfont) return;
 
-	FcPattern *pattern = fontList->fonts[index];
+	u32 flags;
+	fontFaces[index] = loadFace(ftlib, fontList->fonts[index], flags);
+	fontFlags[index] = flags;
+}
 
+// open a font of the list with its own FreeType library, faces can't be shared between threads
+static FT_Face loadFace(FT_Library lib, FcPattern *pattern, u32 &flags)
+{
 	FcChar8 *name = (FcChar8 *)"";
 	FcPatternGetString(pattern, FC_FILE, 0, &name);
 
@@ -239,15 +903,25 @@ static void openFont(u32 index)
 	FcPatternGetInteger (pattern, FC_INDEX, 0, &id);
 
 	FT_Face face;
-	if (FT_New_Face(ftlib, (const char *)name, id, &face)) {
-		fontFaces[index] = (FT_Face)-1;
-		return;
-	}
+	if (FT_New_Face(lib, (const char *)name, id, &face)) return (FT_Face)-1;
+
+	FT_Set_Pixel_Sizes(face, 0, (FT_UInt)patternSize(pattern));
+
+	flags = loadFlags(pattern);
+	return face;
+}
 
-	double ysize;
+// the pixel size of a font of the list, patterns keep the one they were matched with
+static double patternSize(FcPattern *pattern)
+{
+	double ysize = 0;
 	FcPatternGetDouble(pattern, FC_PIXEL_SIZE, 0, &ysize);
-	FT_Set_Pixel_Sizes(face, 0, (FT_UInt)ysize);
 
+	return pixelSize == basePixels ? ysize : ysize * pixelSize / basePixels;
+}
+
+static u32 loadFlags(FcPattern *pattern)
+{
 	int load_flags = FT_LOAD_DEFAULT;
 
 	FcBool scalable, antialias;
@@ -271,16 +945,23 @@ static void openFont(u32 index)
 		load_flags |= FT_LOAD_TARGET_MONO;
 	}
 
-	fontFaces[index] = face;
-	fontFlags[index] = load_flags;
+	return load_flags;
 }
 
 static int fontIndex(u32 unicode)
 {
-	if (!FcCharSetHasChar(unicodeMap, unicode)) return -1;
-
+	// most characters are in the best match, the others wait for the whole list
 	FcCharSet *charset;
-	for (u32 i = 0; i < fontList->nfont; i++) {
+	FcPatternGetCharSet(fontList->fonts[0], FC_CHARSET, 0, &charset);
+	if (FcCharSetHasChar(charset, unicode)) return 0;
+
+	resolveFonts();
+	if (!unicodeMap || !FcCharSetHasChar(unicodeMap, unicode)) return -1;
+
+	// face numbers must fit in a byte below FACE_BOX
+	u32 nfont = MIN((u32)fontList->nfont, (u32)FACE_BOX);
+
+	for (u32 i = 1; i < nfont; i++) {
 		FcPatternGetCharSet(fontList->fonts[i], FC_CHARSET, 0, &charset);
 		if (FcCharSetHasChar(charset, unicode)) return i;
 	}
@@ -288,60 +969,1004 @@ static int fontIndex(u32 unicode)
 	return -1;
 }
 
-Font::Glyph *Font::getGlyph(u32 unicode)
+// fontconfig fonts behind a bitmap font are loaded on the first character it hasn't,
+// sized to its cell height. false when there are no fonts to look in
+static bool loadFallback()
+{
+	if (fontList) return true;
+	if (!bitmapFont || fallbackTried) return false;
+	fallbackTried = true;
+
+	bool fallback = true;
+	Config::instance()->getOption("font-fallback", fallback);
+	return fallback && loadFontList(cellHeight);
+}
+
+// look the character up in the fonts once, false when no font can draw it.
+// fresh is set when no character of the same page was looked up before
+static bool charFace(u32 unicode, u32 &face, u32 &index, bool &fresh)
+{
+	CharPage *page = charPages[unicode >> 8];
+	fresh = !page;
+
+	if (!page) {
+		page = new CharPage;
+		memset(page->faces, FACE_UNKNOWN, sizeof(page->faces));
+		__atomic_store_n(&charPages[unicode >> 8], page, __ATOMIC_RELEASE);
+	}
+
+	u32 c = unicode & 0xff;
+	if (page->faces[c] == FACE_UNKNOWN) {
+		u8 found = FACE_MISSING;
+
+		s32 glyph = (bitmapFont ? bitmapFont->glyphIndex(unicode) : -1);
+		if (boxGlyphs && isBoxChar(unicode)) {
+			found = FACE_BOX;
+		} else if (glyph != -1) {
+			page->indexes[c] = glyph;
+			found = FACE_BITMAP;
+		} else if (loadFallback()) {
+			int i = fontIndex(unicode);
+			if (i != -1 && !fontFaces[i]) openFont(i);
+
+			if (i != -1 && fontFaces[i] != (FT_Face)-1) {
+				page->indexes[c] = FT_Get_Char_Index(fontFaces[i], (FT_ULong)unicode);
+				if (page->indexes[c]) found = i;
+			}
+		}
+
+		__atomic_store_n(&page->faces[c], found, __ATOMIC_RELAXED);
+
+		if (!statsOn);
+		else if (found == FACE_MISSING) missingChars++;
+		else if (found == FACE_BITMAP) bitmapChars++;
+		else if (found == FACE_BOX) boxChars++;
+		else faceDepths[MIN(found, DEPTH_BUCKETS - 1)]++;
+	}
+
+	face = page->faces[c];
+	index = page->indexes[c];
+	return face != FACE_MISSING;
+}
+
+static inline bool charMissing(u32 unicode)
 {
-	if (unicode >= 256 * 256) return 0;
+	CharPage *page = __atomic_load_n(&charPages[unicode >> 8], __ATOMIC_ACQUIRE);
+	return page && __atomic_load_n(&page->faces[unicode & 0xff], __ATOMIC_RELAXED) == FACE_MISSING;
+}
 
-	if (!glyphCacheInited[unicode >> 8]) {
-		glyphCacheInited[unicode >> 8] = true;
-		memset(&glyphCache[unicode & 0xff00], 0, sizeof(Glyph *) * 256);
+static u64 hashBytes(u64 hash, const void *data, u32 len)
+{
+	for (const u8 *p = (const u8 *)data; len--; p++) {
+		hash = (hash ^ *p) * 0x100000001b3ULL;
 	}
+	return hash;
+}
 
-	if (glyphCache[unicode]) return glyphCache[unicode];
+// whether a mapped header belongs to these fonts and this size and its index fits in the file
+static bool diskValid(const DiskHeader &header, u64 key, u32 size)
+{
+	// a power of two of index entries that fits in the file with the header
+	return !memcmp(header.magic, DISK_MAGIC, 8) && header.key == key && header.size == size
+		&& header.entries >= 256 && !(header.entries & (header.entries - 1))
+		&& sizeof(header) + (u64)header.entries * sizeof(u64) <= size
+		&& header.used >= sizeof(header) + (u64)header.entries * sizeof(u64);
+}
 
-	int i = fontIndex(unicode);
-	if (i == -1) return 0;
+// map the shared glyph file, a missing or not matching one is replaced by renaming a new one
+// over it. called once under cacheLock, any failure leaves it disabled.
+static void initDiskCache()
+{
+	diskInited = true;
+
+	u32 megabytes = 0;
+	Config::instance()->getOption("glyph-disk-cache", megabytes);
+	if (!megabytes) return;
+	if (megabytes > 1024) megabytes = 1024;
+
+	if (!bitmapFont) resolveFonts();
+
+	// everything that changes the rendered pixels goes into the key
+	u64 key = hashBytes(0xcbf29ce484222325ULL, DISK_MAGIC, 8);
+	if (bitmapFont) {
+		// fallback fonts may not be loaded yet, their names stand for them
+		struct stat st;
+		if (stat(bitmapFont->name(), &st) == -1) memset(&st, 0, sizeof(st));
+
+		s64 mtime = st.st_mtime, size = st.st_size;
+		bool fallback = true;
+		s8 names[64];
+		Config::instance()->getOption("font-fallback", fallback);
+		Config::instance()->getOption("font-names", names, sizeof(names));
+
+		key = hashBytes(key, bitmapFont->name(), strlen(bitmapFont->name()) + 1);
+		key = hashBytes(key, &mtime, sizeof(mtime));
+		key = hashBytes(key, &size, sizeof(size));
+		key = hashBytes(key, &fallback, sizeof(fallback));
+		if (fallback) key = hashBytes(key, names, strlen(names) + 1);
+	}
 
-	if (!fontFaces[i]) openFont(i);
-	if (fontFaces[i] == (FT_Face)-1) return 0;
+	for (u32 i = 0; !bitmapFont && i < fontList->nfont; i++) {
+		FcPattern *pattern = fontList->fonts[i];
 
-	FT_Face face = fontFaces[i];
-	FT_UInt index = FT_Get_Char_Index(face, (FT_ULong)unicode);
-	if (!index) return 0;
+		FcChar8 *file = (FcChar8 *)"";
+		FcPatternGetString(pattern, FC_FILE, 0, &file);
 
-	FT_Load_Glyph(face, index, FT_LOAD_RENDER | fontFlags[i]);
-	FT_Bitmap &bitmap = face->glyph->bitmap;
+		struct stat st;
+		if (stat((const char *)file, &st) == -1) memset(&st, 0, sizeof(st));
 
-	u32 x, y, w, h, nx, ny, nw, nh;
-	x = y = 0;
-	w = nw = bitmap.width;
-	h = nh = bitmap.rows;
-	u8 *buf = bitmap.buffer;
-	s32 top = (s32)mBaseline - face->glyph->bitmap_top;
-	if (top < 0) {
-		buf -= top * bitmap.pitch;
-		h = nh += top;
-		top = 0;
+		int id = 0;
+		double ysize = patternSize(pattern);
+		FcPatternGetInteger(pattern, FC_INDEX, 0, &id);
+
+		u32 flags = loadFlags(pattern);
+		s64 mtime = st.st_mtime, size = st.st_size;
+
+		key = hashBytes(key, file, strlen((const char *)file) + 1);
+		key = hashBytes(key, &mtime, sizeof(mtime));
+		key = hashBytes(key, &size, sizeof(size));
+		key = hashBytes(key, &id, sizeof(id));
+		key = hashBytes(key, &ysize, sizeof(ysize));
+		key = hashBytes(key, &flags, sizeof(flags));
+	}
+
+	// instances with another file size use another file, the size of a mapped file never changes
+	u32 size = megabytes << 20;
+	u32 cell[6] = { cellWidth, cellHeight, (u32)cellBaseline, Screen::instance()->rotateType(), boxGlyphs, size };
+	key = hashBytes(key, cell, sizeof(cell));
+
+	const s8 *home = getenv("HOME");
+	if (!home) home = "/root";
+
+	s8 name[256];
+	snprintf(name, sizeof(name), "%s/.cache", home);
+	mkdir(name, 0700);
+	snprintf(name, sizeof(name), "%s/.cache/fbterm", home);
+	mkdir(name, 0700);
+	snprintf(name, sizeof(name), "%s/.cache/fbterm/glyphs-%016llx", home, key);
+
+	// a file found broken is replaced by a new one renamed over it, instances still mapping the
+	// old one keep using it. the lock is taken on the file under the name, one was renamed over
+	// the opened file when they differ, and it is opened again
+	s32 fd = -1;
+	bool valid = false;
+	struct stat st, cur;
+	DiskHeader header;
+
+	for (u32 tries = 0; !valid && tries < 4; tries++) {
+		fd = open(name, O_RDWR | O_CREAT, 0600);
+		if (fd == -1) return;
+
+		flock(fd, LOCK_EX);
+		if (fstat(fd, &st) || stat(name, &cur) || st.st_ino != cur.st_ino) {
+			close(fd);
+			fd = -1;
+			continue;
+		}
+
+		valid = st.st_size == size && pread(fd, &header, sizeof(header), 0) == sizeof(header) && diskValid(header, key, size);
+		if (valid) break;
+
+		s8 temp[272];
+		snprintf(temp, sizeof(temp), "%s.%d", name, getpid());
+
+		s32 tfd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (tfd != -1) {
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, DISK_MAGIC, 8);
+			header.key = key;
+			header.size = size;
+
+			// room for one glyph per 128 bytes of data at most half full
+			for (header.entries = 256; header.entries < size / 64; header.entries *= 2);
+			header.used = (sizeof(header) + header.entries * sizeof(u64) + DISK_ALIGN - 1) & ~(DISK_ALIGN - 1);
+
+			valid = !ftruncate(tfd, size) && pwrite(tfd, &header, sizeof(header), 0) == sizeof(header) && !rename(temp, name);
+			if (!valid) unlink(temp);
+		}
+
+		close(fd);
+		fd = tfd;
+		break;
+	}
+
+	if (fd == -1) return;
+	flock(fd, LOCK_UN);
+
+	void *map = (valid ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED);
+	close(fd);
+	if (map == MAP_FAILED) return;
+
+	diskCache = (DiskHeader *)map;
+	diskSize = size;
+	for (diskBits = 0; (1U << diskBits) < header.entries; diskBits++);
+	diskMask = header.entries - 1;
+	__atomic_store_n(&diskIndex, (u64 *)(diskCache + 1), __ATOMIC_RELEASE);
+}
+
+// file offset of the glyph, 0 when not in the file
+static u32 diskFind(u32 unicode)
+{
+	u64 key = (u64)(unicode + 1) << 32;
+
+	for (u32 i = (unicode * 0x9e3779b1) >> (32 - diskBits), n = 0; n <= diskMask; i = (i + 1) & diskMask, n++) {
+		u64 entry = __atomic_load_n(&diskIndex[i], __ATOMIC_ACQUIRE);
+		if (!entry) return 0;
+		if ((entry & ~0xffffffffULL) == key) return (u32)entry * DISK_ALIGN;
+	}
+	return 0;
+}
+
+static Font::Glyph *diskGlyph(u32 unicode, bool dw)
+{
+	if (!__atomic_load_n(&diskIndex, __ATOMIC_ACQUIRE)) return 0;
+
+	u32 offset = diskFind(unicode);
+	if (!offset) return 0;
+
+	// the file may have been written by anything, glyphs must lie in the data after the index
+	u32 x = 0, y = 0, w = (dw ? cellWidth * 2 : cellWidth), h = cellHeight;
+	Screen::instance()->rotateRect(x, y, w, h);
+
+	u64 bytes = OFFSET(Font::Glyph, pixmap) + (u64)w * h;
+	if (offset < sizeof(DiskHeader) + (u64)(diskMask + 1) * sizeof(u64) || offset + bytes > diskSize) return 0;
+
+	// instances may disagree about the width of ambiguous characters
+	Font::Glyph *glyph = (Font::Glyph *)((u8 *)diskCache + offset);
+	if (glyph->width != (s16)(dw ? cellWidth * 2 : cellWidth) || glyph->pitch <= 0 || glyph->height <= 0
+		|| (u64)glyph->pitch * glyph->height > bytes - OFFSET(Font::Glyph, pixmap)) return 0;
+	return glyph;
+}
+
+// reserve room for a glyph of size bytes, 0 when the file is full
+static Font::Glyph *diskAlloc(u32 size, u32 &offset)
+{
+	if (!diskIndex || __atomic_load_n(&diskCache->count, __ATOMIC_RELAXED) >= (diskMask + 1) / 2) return 0;
+
+	u32 bytes = (size + SLOT_PAD + DISK_ALIGN - 1) & ~(DISK_ALIGN - 1);
+	if (__atomic_load_n(&diskCache->used, __ATOMIC_RELAXED) + bytes > diskSize) return 0;
+
+	offset = __atomic_fetch_add(&diskCache->used, bytes, __ATOMIC_RELAXED);
+	if ((u64)offset + bytes > diskSize) return 0;
+
+	return (Font::Glyph *)((u8 *)diskCache + offset);
+}
+
+// publish a glyph written at offset, another instance may have stored the same one first
+static void diskInsert(u32 unicode, u32 offset)
+{
+	u64 key = (u64)(unicode + 1) << 32, entry = key | (offset / DISK_ALIGN);
+
+	for (u32 i = (unicode * 0x9e3779b1) >> (32 - diskBits), n = 0; n <= diskMask; i = (i + 1) & diskMask, n++) {
+		u64 cur = 0;
+		if (__atomic_compare_exchange_n(&diskIndex[i], &cur, entry, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			__atomic_add_fetch(&diskCache->count, 1, __ATOMIC_RELAXED);
+			return;
+		}
+
+		if ((cur & ~0xffffffffULL) == key) return;
+	}
+}
+
+static inline u32 hashIndex(u32 unicode)
+{
+	return (unicode * 0x9e3779b1) >> (32 - tableBits);
+}
+
+static inline Font::Glyph *slotGlyph(u32 ref)
+{
+	SlabClass &c = slabs[ref >> 31];
+	u32 slot = ref & ~(1U << 31);
+
+	// set the CLOCK reference bit, without dirtying the cache line when already set.
+	// readers race on it harmlessly, the accesses only need to be atomic
+	if (!__atomic_load_n(&c.refs[slot], __ATOMIC_RELAXED)) __atomic_store_n(&c.refs[slot], 1, __ATOMIC_RELAXED);
+	return (Font::Glyph *)(c.chunks[slot / CHUNK_SLOTS] + (slot % CHUNK_SLOTS) * c.slotSize);
+}
+
+static u32 findEntry(u32 unicode)
+{
+	u64 key = (u64)(unicode + 1) << 32;
+
+	for (u32 i = hashIndex(unicode);; i = (i + 1) & tableMask) {
+		u64 entry = __atomic_load_n(&glyphTable[i], __ATOMIC_ACQUIRE);
+		if (entry == ENTRY_EMPTY) return SPILL_REF;
+		if ((entry & ~0xffffffffULL) == key) return (u32)entry;
+	}
+}
+
+static inline Font::Glyph *lookupGlyph(u32 unicode)
+{
+	u32 ref = findEntry(unicode);
+	return ref == SPILL_REF ? 0 : slotGlyph(ref);
+}
+
+static void insertEntry(u32 unicode, u32 ref)
+{
+	u32 i = hashIndex(unicode);
+	for (; glyphTable[i] != ENTRY_EMPTY && glyphTable[i] != ENTRY_DEAD; i = (i + 1) & tableMask);
+
+	if (glyphTable[i] == ENTRY_DEAD) tableDead--;
+
+	// make the bitmap visible before the entry pointing to it
+	__atomic_store_n(&glyphTable[i], ((u64)(unicode + 1) << 32) | ref, __ATOMIC_RELEASE);
+}
+
+static void removeEntry(u32 unicode, u32 ref)
+{
+	u32 i = hashIndex(unicode);
+	for (; glyphTable[i] != (((u64)(unicode + 1) << 32) | ref); i = (i + 1) & tableMask);
+
+	glyphTable[i] = ENTRY_DEAD;
+	tableDead++;
+}
+
+static inline u32 shareIndex(u32 hash)
+{
+	return (hash * 0x9e3779b1) >> (32 - tableBits);
+}
+
+static void insertShare(u32 hash, u32 ref)
+{
+	slabs[ref >> 31].hashes[ref & ~(1U << 31)] = hash;
+
+	u32 i = shareIndex(hash);
+	for (; shareTable[i] && shareTable[i] != SHARE_DEAD; i = (i + 1) & tableMask);
+
+	if (shareTable[i] == SHARE_DEAD) shareDead--;
+	shareTable[i] = ref + 1;
+}
+
+static void insertGlyph(u32 unicode, u32 ref)
+{
+	SlabClass &c = slabs[ref >> 31];
+	u32 slot = ref & ~(1U << 31);
+
+	c.keys[slot] = unicode;
+	c.aliases[slot] = 0;
+	insertEntry(unicode, ref);
+}
+
+// the cached slot holding the same bitmap, SPILL_REF if there is none
+static u32 findShared(u32 hash, const Font::Glyph *glyph, u32 size)
+{
+	u32 cls = (size + SLOT_PAD > slabs[0].slotSize);
+
+	for (u32 i = shareIndex(hash);; i = (i + 1) & tableMask) {
+		u32 entry = shareTable[i];
+		if (!entry) return SPILL_REF;
+		if (entry == SHARE_DEAD || (entry - 1) >> 31 != cls) continue;
+
+		SlabClass &c = slabs[cls];
+		u32 slot = (entry - 1) & ~(1U << 31);
+		if (c.hashes[slot] != hash) continue;
+
+		// equal headers mean equal sizes
+		const u8 *bytes = c.chunks[slot / CHUNK_SLOTS] + (slot % CHUNK_SLOTS) * c.slotSize;
+		if (!memcmp(bytes, glyph, size)) return entry - 1;
+	}
+}
+
+// enter a newly rendered glyph, held in slot ref or spilled. when an identical bitmap is
+// cached already the code point points to that one, and the new slot is freed again
+static Font::Glyph *storeGlyph(u32 unicode, u32 ref, Font::Glyph *glyph, u32 size)
+{
+	u32 hash = (u32)hashBytes(0xcbf29ce484222325ULL, glyph, size);
+	u32 shared = (aliasFree ? findShared(hash, glyph, size) : SPILL_REF);
+
+	if (shared != SPILL_REF) {
+		if (ref != SPILL_REF) {
+			SlabClass &c = slabs[ref >> 31];
+			u32 slot = ref & ~(1U << 31);
+			c.refs[slot] = 2;
+			c.freeSlots[c.freeCount++] = slot;
+		}
+
+		SlabClass &c = slabs[shared >> 31];
+		u32 slot = shared & ~(1U << 31), alias = aliasFree;
+		aliasFree = aliasPool[alias].next;
+		aliasPool[alias].unicode = unicode;
+		aliasPool[alias].next = c.aliases[slot];
+		c.aliases[slot] = alias;
+
+		insertEntry(unicode, shared);
+		cacheShared++;
+		return slotGlyph(shared);
+	}
+
+	if (ref != SPILL_REF) {
+		insertGlyph(unicode, ref);
+		insertShare(hash, ref);
+	}
+	return glyph;
+}
+
+// take a free slot big enough for size bytes, or carve a new chunk while within budget.
+// when the cache is full a needed glyph is spilled, and unused slots are freed once possible,
+// a prerendered one isn't stored at all.
+static Font::Glyph *allocGlyph(u32 size, u32 &ref, bool needed)
+{
+	u32 cls = (size + SLOT_PAD > slabs[0].slotSize);
+	SlabClass &c = slabs[cls];
+
+	if (!c.freeCount && c.slots < c.maxSlots && (!c.slots || cacheBytes + c.slotSize * CHUNK_SLOTS <= cacheBudget)) {
+		void *chunk;
+		if (!posix_memalign(&chunk, SLOT_ALIGN, c.slotSize * CHUNK_SLOTS)) {
+			c.chunks[c.slots / CHUNK_SLOTS] = (u8 *)chunk;
+			for (u32 i = CHUNK_SLOTS; i--;) {
+				c.freeSlots[c.freeCount++] = c.slots + i;
+				c.refs[c.slots + i] = 2;
+			}
+
+			c.slots += CHUNK_SLOTS;
+			cacheBytes += c.slotSize * CHUNK_SLOTS;
+		}
+	}
+
+	if (c.freeCount) {
+		u32 slot = c.freeSlots[--c.freeCount];
+		c.refs[slot] = needed;
+
+		ref = (cls << 31) | slot;
+		return (Font::Glyph *)(c.chunks[slot / CHUNK_SLOTS] + (slot % CHUNK_SLOTS) * c.slotSize);
+	}
+
+	if (!needed) return 0;
+
+	SpillGlyph *spill = (SpillGlyph *)new u8[OFFSET(SpillGlyph, glyph) + size];
+	spill->next = spills;
+	spills = spill;
+	__atomic_store_n(&evictPending, true, __ATOMIC_RELAXED);
+
+	ref = SPILL_REF;
+	return &spill->glyph;
+}
+
+// free spilled glyphs and sweep CLOCK hands until an eighth of each class is free again,
+// called with no reader holding glyph pointers
+static void evictGlyphs()
+{
+	evictPending = false;
+
+	while (spills) {
+		SpillGlyph *next = spills->next;
+		delete[] (u8 *)spills;
+		spills = next;
+	}
+
+	for (u32 cls = 0; cls < 2; cls++) {
+		SlabClass &c = slabs[cls];
+		u32 target = c.slots / 8;
+
+		for (u32 steps = 2 * c.slots; c.freeCount < target && steps--; c.hand = (c.hand + 1) % c.slots) {
+			if (c.refs[c.hand] == 1) {
+				c.refs[c.hand] = 0;
+				continue;
+			}
+
+			// free slots are marked 2, they aren't in the table
+			if (c.refs[c.hand] == 2) continue;
+
+			u32 ref = (cls << 31) | c.hand;
+			removeEntry(c.keys[c.hand], ref);
+
+			while (c.aliases[c.hand]) {
+				u32 alias = c.aliases[c.hand];
+				removeEntry(aliasPool[alias].unicode, ref);
+
+				c.aliases[c.hand] = aliasPool[alias].next;
+				aliasPool[alias].next = aliasFree;
+				aliasFree = alias;
+			}
+
+			u32 i = shareIndex(c.hashes[c.hand]);
+			for (; shareTable[i] != ref + 1; i = (i + 1) & tableMask);
+			shareTable[i] = SHARE_DEAD;
+			shareDead++;
+			cacheEvictions++;
+
+			c.refs[c.hand] = 2;
+			c.freeSlots[c.freeCount++] = c.hand;
+		}
+	}
+
+	if (tableDead < (tableMask + 1) / 4 && shareDead < (tableMask + 1) / 4) return;
+
+	// too many dead entries lengthen probing, rebuild the tables from the live slots
+	memset(glyphTable, 0, sizeof(u64) * (tableMask + 1));
+	memset(shareTable, 0, sizeof(u32) * (tableMask + 1));
+	tableDead = shareDead = 0;
+
+	for (u32 cls = 0; cls < 2; cls++) {
+		SlabClass &c = slabs[cls];
+		for (u32 slot = 0; slot < c.slots; slot++) {
+			if (c.refs[slot] == 2) continue;
+
+			u32 ref = (cls << 31) | slot;
+			insertEntry(c.keys[slot], ref);
+			insertShare(c.hashes[slot], ref);
+
+			for (u32 alias = c.aliases[slot]; alias; alias = aliasPool[alias].next) {
+				insertEntry(aliasPool[alias].unicode, ref);
+			}
+		}
+	}
+}
+
+// glyph pointers are valid between holdGlyphs and releaseGlyphs, the last reader to leave
+// evicts unused glyphs when the cache ran full meanwhile
+void Font::holdGlyphs()
+{
+	while (1) {
+		u32 readers = __atomic_load_n(&glyphReaders, __ATOMIC_ACQUIRE);
+		if (readers & EVICTING) {
+			sched_yield();
+			continue;
+		}
+
+		if (__atomic_compare_exchange_n(&glyphReaders, &readers, readers + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+	}
+}
+
+void Font::releaseGlyphs()
+{
+	if (threadHits) {
+		__atomic_add_fetch(&cacheHits, threadHits, __ATOMIC_RELAXED);
+		threadHits = 0;
+	}
+
+	if (__atomic_sub_fetch(&glyphReaders, 1, __ATOMIC_RELEASE) || !__atomic_load_n(&evictPending, __ATOMIC_RELAXED)) return;
+
+	u32 idle = 0;
+	if (!__atomic_compare_exchange_n(&glyphReaders, &idle, EVICTING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+
+	pthread_mutex_lock(&cacheLock);
+	if (evictPending) evictGlyphs();
+	pthread_mutex_unlock(&cacheLock);
+
+	__atomic_store_n(&glyphReaders, 0, __ATOMIC_RELEASE);
+}
+
+// count a draw for glyph-stats and add it to the trace
+static void countGlyph(u32 unicode, bool dw)
+{
+	UsagePage *page = __atomic_load_n(&usagePages[unicode >> 8], __ATOMIC_ACQUIRE);
+	if (!page) {
+		UsagePage *fresh = new UsagePage;
+		memset(fresh, 0, sizeof(UsagePage));
+
+		// another thread may have published the page first, page is then set to it
+		if (__atomic_compare_exchange_n(&usagePages[unicode >> 8], &page, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) page = fresh;
+		else delete fresh;
+	}
+
+	__atomic_add_fetch(&page->draws[unicode & 0xff], 1, __ATOMIC_RELAXED);
+	if (dw) __atomic_store_n(&page->wide[unicode & 0xff], 1, __ATOMIC_RELAXED);
+
+	u64 n = __atomic_fetch_add(&traceCount, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&traceDraws[n & (TRACE_SIZE - 1)], unicode | (dw ? TRACE_WIDE : 0), __ATOMIC_RELAXED);
+}
+
+static u64 monotonicTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// glyphs may be requested by several rendering threads at once, cached glyphs are read
+// without locking while FreeType and cache insertion are serialized by cacheLock.
+// callers must hold glyphs, see holdGlyphs
+Font::Glyph *Font::getGlyph(u32 unicode, bool dw)
+{
+	if (unicode > 0x10ffff || !glyphTable) return 0;
+	if (statsOn) countGlyph(unicode, dw);
+
+	Glyph *glyph = diskGlyph(unicode, dw);
+	if (!glyph) glyph = lookupGlyph(unicode);
+	if (glyph) {
+		threadHits++;
+		return glyph;
 	}
+
+	// characters no font has are remembered, they don't take the lock again
+	if (charMissing(unicode)) return 0;
+
+	pthread_mutex_lock(&cacheLock);
+	// the file is keyed by all fonts, so it waits until they are sorted
+	if (!diskInited && (bitmapFont || !sortStarted || __atomic_load_n(&sortDone, __ATOMIC_ACQUIRE))) initDiskCache();
+
+	glyph = diskGlyph(unicode, dw);
+	if (!glyph) glyph = lookupGlyph(unicode);
+	if (!glyph) glyph = renderGlyph(unicode, dw);
+	pthread_mutex_unlock(&cacheLock);
+
+	return glyph;
+}
+
+// transpose an 8x8 block of bytes, either pitch may be negative to flip the block
+static inline void transpose8(u8 *dst, s32 dpitch, const u8 *src, s32 spitch)
+{
+#ifdef __SSE2__
+	__m128i a0 = _mm_loadl_epi64((const __m128i *)src), a1 = _mm_loadl_epi64((const __m128i *)(src + spitch));
+	__m128i a2 = _mm_loadl_epi64((const __m128i *)(src + 2 * spitch)), a3 = _mm_loadl_epi64((const __m128i *)(src + 3 * spitch));
+	__m128i a4 = _mm_loadl_epi64((const __m128i *)(src + 4 * spitch)), a5 = _mm_loadl_epi64((const __m128i *)(src + 5 * spitch));
+	__m128i a6 = _mm_loadl_epi64((const __m128i *)(src + 6 * spitch)), a7 = _mm_loadl_epi64((const __m128i *)(src + 7 * spitch));
+
+	__m128i b0 = _mm_unpacklo_epi8(a0, a1), b1 = _mm_unpacklo_epi8(a2, a3);
+	__m128i b2 = _mm_unpacklo_epi8(a4, a5), b3 = _mm_unpacklo_epi8(a6, a7);
+
+	__m128i c0 = _mm_unpacklo_epi16(b0, b1), c1 = _mm_unpackhi_epi16(b0, b1);
+	__m128i c2 = _mm_unpacklo_epi16(b2, b3), c3 = _mm_unpackhi_epi16(b2, b3);
+
+	__m128i d[4] = { _mm_unpacklo_epi32(c0, c2), _mm_unpackhi_epi32(c0, c2), _mm_unpacklo_epi32(c1, c3), _mm_unpackhi_epi32(c1, c3) };
+
+	for (u32 i = 0; i < 4; i++, dst += 2 * dpitch) {
+		_mm_storel_epi64((__m128i *)dst, d[i]);
+		_mm_storel_epi64((__m128i *)(dst + dpitch), _mm_srli_si128(d[i], 8));
+	}
+#else
+	for (s32 i = 0; i < 8; i++, dst += dpitch) {
+		for (s32 j = 0; j < 8; j++) {
+			dst[j] = src[j * spitch + i];
+		}
+	}
+#endif
+}
+
+// rotate an upright w x h cell clockwise, the pitch of dst is the rotated width.
+// quarter turns are done in 8x8 transposed blocks, the edges left over byte by byte.
+static void rotateCell(u8 *dst, const u8 *src, u32 w, u32 h, RotateType type)
+{
+	if (type == Rotate180) {
+		const u8 *s = src + w * h;
+		for (u32 i = w * h; i--;) {
+			*dst++ = *--s;
+		}
+		return;
+	}
+
+	// Rotate90: (x, y) -> (h - 1 - y, x), Rotate270: (x, y) -> (y, w - 1 - x)
+	u32 bw = w & ~7, bh = h & ~7;
+	for (u32 y = 0; y < bh; y += 8) {
+		for (u32 x = 0; x < bw; x += 8) {
+			if (type == Rotate90) transpose8(dst + x * h + h - 8 - y, h, src + (y + 7) * w + x, -(s32)w);
+			else transpose8(dst + (w - 1 - x) * h + y, -(s32)h, src + y * w + x, w);
+		}
+	}
+
+	for (u32 y = 0; y < h; y++) {
+		for (u32 x = (y < bh ? bw : 0); x < w; x++) {
+			if (type == Rotate90) dst[x * h + h - 1 - y] = src[y * w + x];
+			else dst[(w - 1 - x) * h + y] = src[y * w + x];
+		}
+	}
+}
+
+// a glyph image to be placed in the cell, left and top are its offset from the cell origin
+struct GlyphBitmap {
+	const u8 *buffer;
+	s32 pitch;
+	u32 width, rows;
+	s32 left, top;
+	bool mono;
+};
+
+static void slotBitmap(GlyphBitmap &image, FT_GlyphSlot slot)
+{
+	FT_Bitmap &bitmap = slot->bitmap;
+	image.buffer = bitmap.buffer;
+	image.pitch = bitmap.pitch;
+	image.width = bitmap.width;
+	image.rows = bitmap.rows;
+	image.left = slot->bitmap_left;
+	image.top = cellBaseline - slot->bitmap_top;
+	image.mono = (bitmap.pixel_mode == FT_PIXEL_MODE_MONO);
+}
+
+// bitmap font glyphs are read straight from the font file mapping
+static void fontBitmap(GlyphBitmap &image, u32 index)
+{
+	image.buffer = bitmapFont->glyph(index);
+	image.pitch = bitmapFont->pitch();
+	image.width = bitmapFont->boxWidth();
+	image.rows = bitmapFont->height();
+	image.left = image.top = 0;
+	image.mono = true;
+}
+
+// box drawing characters are drawn to pixels, which must hold a wide cell
+static void boxBitmap(GlyphBitmap &image, u8 *pixels, u32 unicode, bool dw)
+{
+	image.width = (dw ? cellWidth * 2 : cellWidth);
+	image.rows = cellHeight;
+	drawBoxChar(unicode, pixels, image.width, image.rows);
+
+	image.buffer = pixels;
+	image.pitch = image.width;
+	image.left = image.top = 0;
+	image.mono = false;
+}
+
+static u32 glyphBytes(const GlyphBitmap &image, bool dw)
+{
+	u32 x = 0, y = 0, w = (dw ? cellWidth * 2 : cellWidth), h = cellHeight;
+	Screen::instance()->rotateRect(x, y, w, h);
+
+	return OFFSET(Font::Glyph, pixmap) + (image.mono ? (w + 7) >> 3 : w) * h;
+}
+
+static void fillGlyph(Font::Glyph *glyph, const GlyphBitmap &image, bool dw)
+{
+	u32 x, y, w, h, nw, nh;
+	x = y = 0;
+	w = nw = (dw ? cellWidth * 2 : cellWidth);
+	h = nh = cellHeight;
 	Screen::instance()->rotateRect(x, y, nw, nh);
 
-	Glyph *glyph = (Glyph *)new u8[OFFSET(Glyph, pixmap) + nw * nh];
-	glyph->left = face->glyph->bitmap_left;
-	glyph->top = top;
+	bool mono = image.mono;
+	u32 pitch = (mono ? (nw + 7) >> 3 : nw);
+
 	glyph->width = w;
 	glyph->height = h;
-	glyph->pitch = nw;
+	glyph->pitch = pitch;
+	glyph->mono = mono;
+
+	// the bitmap is placed upright in the cell first with a byte per pixel, then the whole
+	// cell is rotated, mono cells are packed to bits at last
+	RotateType rotate = Screen::instance()->rotateType();
+	bool direct = (rotate == Rotate0 && !mono);
+	u8 upright[direct ? 1 : w * h], rotated[rotate != Rotate0 && mono ? w * h : 1];
+	u8 *cell = (direct ? glyph->pixmap : upright);
+	memset(cell, 0, w * h);
+
+	// pixels falling outside of the cell are clipped
+	s32 left = image.left, top = image.top;
+
+	s32 startx = (left < 0 ? -left : 0), starty = (top < 0 ? -top : 0);
+	s32 endx = MIN((s32)image.width, (s32)w - left), endy = MIN((s32)image.rows, (s32)h - top);
+
+	const u8 *buf = image.buffer + starty * image.pitch;
+	for (y = starty; (s32)y < endy; y++, buf += image.pitch) {
+		u8 *dst = cell + (top + y) * w + left;
+
+		if (mono) {
+			for (x = startx; (s32)x < endx; x++) {
+				dst[x] = (buf[(x >> 3)] & (0x80 >> (x & 7))) ? 0xff : 0;
+			}
+		} else if (endx > startx) {
+			memcpy(dst + startx, buf + startx, endx - startx);
+		}
+	}
 
-	for (y = 0; y < h; y++, buf += bitmap.pitch) {
-		for (x = 0; x < w; x++) {
-			nx = x, ny = y;
-			Screen::instance()->rotatePoint(w, h, nx, ny);
+	u8 *bytes = cell;
+	if (rotate != Rotate0) {
+		bytes = (mono ? rotated : glyph->pixmap);
+		rotateCell(bytes, cell, w, h, rotate);
+	}
 
-			glyph->pixmap[ny * nw + nx] =
-				(bitmap.pixel_mode == FT_PIXEL_MODE_MONO) ? ((buf[(x >> 3)] & (0x80 >> (x & 7))) ? 0xff : 0) : buf[x];
+	if (mono) {
+		memset(glyph->pixmap, 0, pitch * nh);
+		for (y = 0; y < nh; y++, bytes += nw) {
+			u8 *bits = glyph->pixmap + y * pitch;
+			for (x = 0; x < nw; x++) {
+				if (bytes[x]) bits[x >> 3] |= 0x80 >> (x & 7);
+			}
 		}
 	}
+}
 
-	glyphCache[unicode] = glyph;
+Font::Glyph *Font::renderGlyph(u32 unicode, bool dw)
+{
+	u32 i, index;
+	bool fresh;
+	if (!charFace(unicode, i, index, fresh)) return 0;
+
+	u64 start = (statsOn ? monotonicTime() : 0);
+
+	GlyphBitmap image;
+	u8 pixels[i == FACE_BOX ? cellWidth * 2 * cellHeight : 1];
+	if (i == FACE_BOX) {
+		boxBitmap(image, pixels, unicode, dw);
+	} else if (i == FACE_BITMAP) {
+		fontBitmap(image, index);
+	} else {
+		// the character may have been looked up at another size
+		if (!fontFaces[i]) openFont(i);
+		if (fontFaces[i] == (FT_Face)-1) return 0;
+
+		FT_Load_Glyph(fontFaces[i], index, FT_LOAD_RENDER | fontFlags[i]);
+		slotBitmap(image, fontFaces[i]->glyph);
+	}
+
+	u32 size = glyphBytes(image, dw);
+	cacheMisses++;
+
+	// glyphs go to the shared file when there is room, unless it has one of another width
+	u32 offset;
+	Glyph *glyph = ((!diskIndex || !diskFind(unicode)) ? diskAlloc(size, offset) : 0);
+	if (glyph) {
+		fillGlyph(glyph, image, dw);
+		diskInsert(unicode, offset);
+	} else {
+		u32 ref;
+		glyph = allocGlyph(size, ref, true);
+		fillGlyph(glyph, image, dw);
+		glyph = storeGlyph(unicode, ref, glyph, size);
+	}
+
+	if (statsOn) {
+		u32 bucket = 0;
+		for (u64 us = (monotonicTime() - start) / 1000; us && bucket < RENDER_BUCKETS - 1; us >>= 1, bucket++);
+		renderTimes[bucket]++;
+	}
+
+	// a new script is likely to be followed by its neighbours
+	if (fresh) prerender(unicode & ~0xff, unicode | 0xff);
 	return glyph;
 }
+
+// queue a range of code points for the prerendering threads, started on first use
+static void prerender(u32 first, u32 last)
+{
+	pthread_mutex_lock(&queueLock);
+
+	if (!prerenderInited) {
+		prerenderInited = true;
+
+		u32 num = 1;
+		Config::instance()->getOption("prerender-threads", num);
+		if (num > MAX_PRERENDER_THREADS) num = MAX_PRERENDER_THREADS;
+
+		// signals are handled by the main thread only
+		sigset_t all, old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &old);
+
+		for (u32 i = 0; i < num; i++) {
+			if (pthread_create(&prerenderThreads[prerenderThreadNum], 0, prerenderEntry, 0)) break;
+			prerenderThreadNum++;
+		}
+
+		pthread_sigmask(SIG_SETMASK, &old, 0);
+
+		// the configured set goes first
+		queueConfigured();
+	}
+
+	// ranges beyond the queue length are dropped, they are only hints
+	if (prerenderThreadNum && (queueTail + 1) % NR_RANGES != queueHead) {
+		prerenderQueue[queueTail].first = first;
+		prerenderQueue[queueTail].last = last;
+		queueTail = (queueTail + 1) % NR_RANGES;
+	}
+
+	if (!prerenderThreadNum) queueHead = queueTail;
+	pthread_cond_signal(&queueWake);
+	pthread_mutex_unlock(&queueLock);
+}
+
+// queue the configured set, given as hexadecimal ranges like 20-7e. called under queueLock
+static void queueConfigured()
+{
+	s8 buf[256];
+	Config::instance()->getOption("prerender-glyphs", buf, sizeof(buf));
+	if (!*buf) strcpy(buf, "20-7e,a0-ff,2500-259f");
+
+	for (s8 *cur = buf; *cur;) {
+		s8 *end;
+		GlyphRange range;
+		range.first = range.last = strtoul(cur, &end, 16);
+		if (*end == '-') range.last = strtoul(end + 1, &end, 16);
+		if (end == cur) break;
+
+		if ((queueTail + 1) % NR_RANGES != queueHead) {
+			prerenderQueue[queueTail] = range;
+			queueTail = (queueTail + 1) % NR_RANGES;
+		}
+
+		cur = end;
+		while (*cur == ',' || *cur == ' ') cur++;
+	}
+}
+
+static void *prerenderEntry(void *arg)
+{
+	FT_Library lib;
+	if (FT_Init_FreeType(&lib)) return 0;
+
+	// fonts behind a bitmap font may be loaded later, faces are opened on first use
+	FT_Face faces[FACE_BOX];
+	u32 flags[FACE_BOX];
+	memset(faces, 0, sizeof(faces));
+	u32 generation = 0;
+
+	pthread_mutex_lock(&queueLock);
+	while (1) {
+		while (!prerenderQuit && (prerenderHold || queueHead == queueTail)) {
+			pthread_cond_wait(&queueWake, &queueLock);
+		}
+		if (prerenderQuit) break;
+
+		GlyphRange range = prerenderQueue[queueHead];
+		queueHead = (queueHead + 1) % NR_RANGES;
+		prerenderBusy++;
+
+		// the faces were opened at the size used before
+		if (generation != prerenderGeneration) {
+			generation = prerenderGeneration;
+			for (u32 i = 0; i < FACE_BOX; i++) {
+				if (faces[i] && faces[i] != (FT_Face)-1) FT_Done_Face(faces[i]);
+			}
+			memset(faces, 0, sizeof(faces));
+		}
+		pthread_mutex_unlock(&queueLock);
+
+		for (u32 unicode = range.first; unicode <= range.last && unicode <= 0x10ffff; unicode++) {
+			if (__atomic_load_n(&prerenderQuit, __ATOMIC_RELAXED) || __atomic_load_n(&prerenderHold, __ATOMIC_RELAXED)) break;
+
+			s32 width = VTerm::charWidth(unicode);
+			if (width < 1) continue;
+
+			u32 i, index;
+			bool fresh, found;
+			FcPattern *pattern = 0;
+
+			// the font list may be switched to the sorted one meanwhile, its patterns stay
+			pthread_mutex_lock(&cacheLock);
+			found = !(diskIndex && diskFind(unicode)) && findEntry(unicode) == SPILL_REF && charFace(unicode, i, index, fresh);
+			if (found && i < FACE_BOX && !faces[i]) pattern = fontList->fonts[i];
+			pthread_mutex_unlock(&cacheLock);
+
+			if (!found) continue;
+
+			GlyphBitmap image;
+			u8 pixels[i == FACE_BOX ? cellWidth * 2 * cellHeight : 1];
+			if (i == FACE_BOX) {
+				boxBitmap(image, pixels, unicode, width == 2);
+			} else if (i == FACE_BITMAP) {
+				fontBitmap(image, index);
+			} else {
+				if (!faces[i]) faces[i] = loadFace(lib, pattern, flags[i]);
+				if (faces[i] == (FT_Face)-1 || FT_Load_Glyph(faces[i], index, FT_LOAD_RENDER | flags[i])) continue;
+				slotBitmap(image, faces[i]->glyph);
+			}
+
+			u32 size = glyphBytes(image, width == 2), offset;
+
+			// the shared file needs no locking
+			Font::Glyph *glyph = diskAlloc(size, offset);
+			if (glyph) {
+				fillGlyph(glyph, image, width == 2);
+				diskInsert(unicode, offset);
+				continue;
+			}
+
+			u8 buf[size];
+			fillGlyph((Font::Glyph *)buf, image, width == 2);
+
+			pthread_mutex_lock(&cacheLock);
+			if (findEntry(unicode) == SPILL_REF) {
+				// with the cache full the glyph may still share a cached bitmap
+				u32 ref = SPILL_REF;
+				Font::Glyph *glyph = allocGlyph(size, ref, false);
+				if (glyph) memcpy(glyph, buf, size);
+				else glyph = (Font::Glyph *)buf;
+
+				storeGlyph(unicode, ref, glyph, size);
+			}
+			pthread_mutex_unlock(&cacheLock);
+		}
+
+		pthread_mutex_lock(&queueLock);
+		if (!--prerenderBusy) pthread_cond_broadcast(&queueIdle);
+	}
+	pthread_mutex_unlock(&queueLock);
+
+	for (u32 i = 0; i < FACE_BOX; i++) {
+		if (faces[i] && faces[i] != (FT_Face)-1) FT_Done_Face(faces[i]);
+	}
+	FT_Done_FreeType(lib);
+
+	return 0;
+}
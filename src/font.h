@@ -30,13 +30,18 @@
 class Font {
 	DECLARE_INSTANCE(Font)
 public:
+	// glyph bitmaps are padded to the whole character cell (one or two columns wide),
+	// with baseline and bearing already applied, stored in the screen's orientation.
+	// mono glyphs keep 1 bit per pixel, most significant bit first, pitch counts bytes.
 	struct Glyph {
 		s16 pitch, width, height;
-		s16 left, top;
+		bool mono;
 		u8 pixmap[0];
 	};
 
-	Glyph *getGlyph(u32 unicode);
+	Glyph *getGlyph(u32 unicode, bool dw);
+	void holdGlyphs();
+	void releaseGlyphs();
 	u32 width() {
 		return mWidth;
 	}
@@ -45,7 +50,24 @@ public:
 	}
 	void showInfo(bool verbose);
 
+	// write the usage statistics to the glyph-stats file, nothing is counted without one
+	void dumpStats();
+
+	// switch the fonts to another pixel size, the cell size follows it. glyphs and faces of
+	// sizes used before are kept. not allowed while glyphs are held, false if it can't be used
+	bool setSize(u32 pixel_size);
+	u32 size();
+
+	// start loading fonts in the background, the first instance() call waits for them
+	static void preload();
+
 private:
+	static Font *loadFont();
+	static void *preloadEntry(void *arg);
+	void initCell();
+	void initCache();
+	Glyph *renderGlyph(u32 unicode, bool dw);
+
 	u32 mWidth, mHeight, mBaseline;
 };
 
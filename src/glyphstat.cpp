@@ -0,0 +1,621 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+// reads the files written with option glyph-stats, prints where the draws go by Unicode block
+// and estimates the hit rate of the glyph cache with other budgets and replacement policies.
+// the recorded trace of draws is replayed against the policies in its order. dumps without a
+// trace only have draw counts, a stream is then generated from them, each glyph drawn
+// independently with its frequency, which hides any locality the real draws had.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "type.h"
+
+#define MAX_CODE 0x110000
+#define RENDER_BUCKETS 16
+#define DEPTH_BUCKETS 8
+#define MAX_BUDGETS 16
+
+struct GlyphUse {
+	u32 unicode, draws;
+	bool wide;
+};
+
+struct Block {
+	u32 first, last;
+	const s8 *name;
+};
+
+static const Block blocks[] = {
+	{ 0x0000, 0x007f, "Basic Latin" },
+	{ 0x0080, 0x00ff, "Latin-1 Supplement" },
+	{ 0x0100, 0x017f, "Latin Extended-A" },
+	{ 0x0180, 0x024f, "Latin Extended-B" },
+	{ 0x0250, 0x02af, "IPA Extensions" },
+	{ 0x02b0, 0x02ff, "Spacing Modifier Letters" },
+	{ 0x0300, 0x036f, "Combining Diacritical Marks" },
+	{ 0x0370, 0x03ff, "Greek and Coptic" },
+	{ 0x0400, 0x04ff, "Cyrillic" },
+	{ 0x0530, 0x058f, "Armenian" },
+	{ 0x0590, 0x05ff, "Hebrew" },
+	{ 0x0600, 0x06ff, "Arabic" },
+	{ 0x0900, 0x097f, "Devanagari" },
+	{ 0x0980, 0x09ff, "Bengali" },
+	{ 0x0e00, 0x0e7f, "Thai" },
+	{ 0x10a0, 0x10ff, "Georgian" },
+	{ 0x1100, 0x11ff, "Hangul Jamo" },
+	{ 0x1e00, 0x1eff, "Latin Extended Additional" },
+	{ 0x1f00, 0x1fff, "Greek Extended" },
+	{ 0x2000, 0x206f, "General Punctuation" },
+	{ 0x2070, 0x209f, "Superscripts and Subscripts" },
+	{ 0x20a0, 0x20cf, "Currency Symbols" },
+	{ 0x2100, 0x214f, "Letterlike Symbols" },
+	{ 0x2150, 0x218f, "Number Forms" },
+	{ 0x2190, 0x21ff, "Arrows" },
+	{ 0x2200, 0x22ff, "Mathematical Operators" },
+	{ 0x2300, 0x23ff, "Miscellaneous Technical" },
+	{ 0x2400, 0x243f, "Control Pictures" },
+	{ 0x2460, 0x24ff, "Enclosed Alphanumerics" },
+	{ 0x2500, 0x257f, "Box Drawing" },
+	{ 0x2580, 0x259f, "Block Elements" },
+	{ 0x25a0, 0x25ff, "Geometric Shapes" },
+	{ 0x2600, 0x26ff, "Miscellaneous Symbols" },
+	{ 0x2700, 0x27bf, "Dingbats" },
+	{ 0x2800, 0x28ff, "Braille Patterns" },
+	{ 0x2e80, 0x2eff, "CJK Radicals Supplement" },
+	{ 0x3000, 0x303f, "CJK Symbols and Punctuation" },
+	{ 0x3040, 0x309f, "Hiragana" },
+	{ 0x30a0, 0x30ff, "Katakana" },
+	{ 0x3100, 0x312f, "Bopomofo" },
+	{ 0x3130, 0x318f, "Hangul Compatibility Jamo" },
+	{ 0x3400, 0x4dbf, "CJK Unified Ideographs Ext A" },
+	{ 0x4e00, 0x9fff, "CJK Unified Ideographs" },
+	{ 0xac00, 0xd7af, "Hangul Syllables" },
+	{ 0xe000, 0xf8ff, "Private Use Area" },
+	{ 0xf900, 0xfaff, "CJK Compatibility Ideographs" },
+	{ 0xff00, 0xffef, "Halfwidth and Fullwidth Forms" },
+	{ 0xfff0, 0xffff, "Specials" },
+	{ 0x1f300, 0x1f5ff, "Misc Symbols and Pictographs" },
+	{ 0x1f600, 0x1f64f, "Emoticons" },
+	{ 0x1f680, 0x1f6ff, "Transport and Map Symbols" },
+	{ 0x1f900, 0x1f9ff, "Supplemental Symbols" },
+	{ 0x20000, 0x2a6df, "CJK Unified Ideographs Ext B" },
+	{ 0xf0000, 0x10ffff, "Supplementary Private Use" },
+};
+
+#define NR_BLOCKS (sizeof(blocks) / sizeof(blocks[0]))
+
+static GlyphUse *glyphs;
+static u32 glyphNum, glyphMax;
+static u32 *glyphIndex;
+
+static u32 cellWidth, cellHeight, slotSizes[2], cacheBudget;
+static u64 hits, misses, evictions, shared, resident, disk;
+static u64 renderTimes[RENDER_BUCKETS];
+static u64 faceDepths[DEPTH_BUCKETS], missingChars, bitmapChars, boxChars;
+static u64 totalDraws;
+
+static u32 *trace;
+static u32 traceLen, traceMax;
+
+static u32 *stream;
+static u32 streamLen;
+
+static void addGlyph(u32 unicode, u32 draws, bool wide)
+{
+	if (unicode >= MAX_CODE) return;
+
+	// dumps of several sessions are added up
+	if (glyphIndex[unicode]) {
+		GlyphUse &g = glyphs[glyphIndex[unicode] - 1];
+		g.draws += draws;
+		g.wide |= wide;
+	} else {
+		if (glyphNum == glyphMax) {
+			glyphMax = (glyphMax ? glyphMax * 2 : 1024);
+			glyphs = (GlyphUse *)realloc(glyphs, sizeof(GlyphUse) * glyphMax);
+		}
+
+		GlyphUse &g = glyphs[glyphNum++];
+		g.unicode = unicode;
+		g.draws = draws;
+		g.wide = wide;
+		glyphIndex[unicode] = glyphNum;
+	}
+
+	totalDraws += draws;
+}
+
+// trace lines hold up to 16 code points in hex, wide ones end in :2
+static void addTrace(const s8 *line)
+{
+	const s8 *cur = line + 5;
+	for (;;) {
+		s8 *end;
+		u32 unicode = strtoul(cur, &end, 16);
+		if (end == cur) break;
+
+		cur = end;
+		if (*cur == ':') strtoul(cur + 1, (s8 **)&cur, 10);
+
+		if (traceLen == traceMax) {
+			traceMax = (traceMax ? traceMax * 2 : 65536);
+			trace = (u32 *)realloc(trace, sizeof(u32) * traceMax);
+		}
+		trace[traceLen++] = unicode;
+	}
+}
+
+static bool readStats(const s8 *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "glyphstat: can't open %s\n", name);
+		return false;
+	}
+
+	s8 line[256], key[32];
+	u64 a, b, c;
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#') continue;
+
+		if (!strncmp(line, "trace ", 6)) addTrace(line);
+		else if (sscanf(line, "glyph %llx %llu %llu", &a, &b, &c) == 3) addGlyph(a, b, c == 2);
+		else if (sscanf(line, "cell %llu %llu", &a, &b) == 2) cellWidth = a, cellHeight = b;
+		else if (sscanf(line, "slots %llu %llu", &a, &b) == 2) slotSizes[0] = a, slotSizes[1] = b;
+		else if (sscanf(line, "budget %llu", &a) == 1) cacheBudget = a;
+		else if (sscanf(line, "render %llu %llu", &a, &b) == 2) {
+			if (a < RENDER_BUCKETS) renderTimes[a] += b;
+		} else if (sscanf(line, "face %31s %llu", key, &b) == 2) {
+			if (!strcmp(key, "missing")) missingChars += b;
+			else if (!strcmp(key, "bitmap")) bitmapChars += b;
+			else if (!strcmp(key, "box")) boxChars += b;
+			else if ((a = atoi(key)) < DEPTH_BUCKETS) faceDepths[a] += b;
+		} else if (sscanf(line, "%31s %llu", key, &a) == 2) {
+			if (!strcmp(key, "hits")) hits += a;
+			else if (!strcmp(key, "misses")) misses += a;
+			else if (!strcmp(key, "evictions")) evictions += a;
+			else if (!strcmp(key, "shared")) shared += a;
+			else if (!strcmp(key, "resident")) resident += a;
+			else if (!strcmp(key, "disk")) disk += a;
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+static inline u32 glyphCost(u32 i)
+{
+	return slotSizes[glyphs[i].wide ? 1 : 0];
+}
+
+static double percent(u64 part, u64 whole)
+{
+	return whole ? part * 100.0 / whole : 0;
+}
+
+static void showSummary()
+{
+	printf("cell %ux%u, slots of %u and %u bytes, budget %uKB\n", cellWidth, cellHeight, slotSizes[0], slotSizes[1], cacheBudget >> 10);
+	printf("recorded: %llu hits, %llu misses (%.2f%% hit rate), %llu evictions, %llu shared, %lluKB resident, %lluKB in the disk cache\n",
+		hits, misses, percent(hits, hits + misses), evictions, shared, resident >> 10, disk >> 10);
+
+	printf("\nrender time:\n");
+	for (u32 i = 0; i < RENDER_BUCKETS; i++) {
+		if (renderTimes[i]) printf("  < %6uus %10llu\n", 1 << i, renderTimes[i]);
+	}
+
+	printf("\ncharacters found in:\n");
+	for (u32 i = 0; i < DEPTH_BUCKETS; i++) {
+		if (faceDepths[i]) printf("  font %u%s %8llu\n", i, i == DEPTH_BUCKETS - 1 ? "+" : " ", faceDepths[i]);
+	}
+	printf("  bitmap  %8llu\n  box     %8llu\n  missing %8llu\n", bitmapChars, boxChars, missingChars);
+}
+
+static int compareDraws(const void *a, const void *b)
+{
+	const GlyphUse *x = (const GlyphUse *)a, *y = (const GlyphUse *)b;
+	if (x->draws != y->draws) return x->draws < y->draws ? 1 : -1;
+	return x->unicode < y->unicode ? -1 : (x->unicode > y->unicode);
+}
+
+static void showBlocks()
+{
+	u64 draws[NR_BLOCKS + 1];
+	u32 counts[NR_BLOCKS + 1], order[NR_BLOCKS + 1];
+	memset(draws, 0, sizeof(draws));
+	memset(counts, 0, sizeof(counts));
+
+	for (u32 i = 0; i < glyphNum; i++) {
+		u32 b;
+		for (b = 0; b < NR_BLOCKS; b++) {
+			if (glyphs[i].unicode >= blocks[b].first && glyphs[i].unicode <= blocks[b].last) break;
+		}
+		draws[b] += glyphs[i].draws;
+		counts[b]++;
+	}
+
+	// blocks by draws, a small insertion sort
+	u32 num = 0;
+	for (u32 b = 0; b <= NR_BLOCKS; b++) {
+		if (!counts[b]) continue;
+
+		u32 i = num++;
+		for (; i && draws[order[i - 1]] < draws[b]; i--) order[i] = order[i - 1];
+		order[i] = b;
+	}
+
+	printf("\n%-32s %8s %12s %8s\n", "block", "glyphs", "draws", "share");
+	for (u32 i = 0; i < num; i++) {
+		u32 b = order[i];
+		printf("%-32s %8u %12llu %7.2f%%\n", b < NR_BLOCKS ? blocks[b].name : "other", counts[b], draws[b], percent(draws[b], totalDraws));
+	}
+
+	printf("\nmost drawn:");
+	for (u32 i = 0; i < glyphNum && i < 16; i++) {
+		printf("%s U+%04X %u", i % 4 ? "," : "\n ", glyphs[i].unicode, glyphs[i].draws);
+	}
+	printf("\n");
+
+	// bytes holding the most drawn glyphs, the cache needs at least this much for these shares
+	const u32 shares[] = { 50, 90, 99, 100 };
+	u64 bytes = 0, covered = 0;
+	u32 s = 0;
+
+	printf("\nworking set:\n");
+	for (u32 i = 0; i < glyphNum && s < 4; i++) {
+		bytes += glyphCost(i);
+		covered += glyphs[i].draws;
+
+		for (; s < 4 && covered * 100 >= totalDraws * shares[s]; s++) {
+			printf("  %3u%% of draws %8u glyphs %8lluKB\n", shares[s], i + 1, (bytes + 1023) >> 10);
+		}
+	}
+}
+
+// xorshift64*, the same stream for the same dumps
+static u64 randomState = 0x9e3779b97f4a7c15ULL;
+
+static u64 nextRandom()
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return randomState * 0x2545f4914f6cdd1dULL;
+}
+
+// draws of characters no font has are not in the glyph table and are left out
+static void traceStream(u32 len)
+{
+	stream = new u32[traceLen];
+	streamLen = 0;
+	for (u32 n = 0; n < traceLen && streamLen < len; n++) {
+		if (trace[n] < MAX_CODE && glyphIndex[trace[n]]) stream[streamLen++] = glyphIndex[trace[n]] - 1;
+	}
+}
+
+static void makeStream(u32 len)
+{
+	u64 *cumulative = new u64[glyphNum];
+	u64 sum = 0;
+	for (u32 i = 0; i < glyphNum; i++) {
+		sum += glyphs[i].draws;
+		cumulative[i] = sum;
+	}
+
+	streamLen = len;
+	stream = new u32[len];
+	for (u32 n = 0; n < len; n++) {
+		u64 pick = nextRandom() % sum;
+
+		u32 low = 0, high = glyphNum - 1;
+		while (low < high) {
+			u32 mid = (low + high) / 2;
+			if (cumulative[mid] > pick) high = mid;
+			else low = mid + 1;
+		}
+		stream[n] = low;
+	}
+
+	delete[] cumulative;
+}
+
+// per glyph state of the replayed caches
+static u8 *present, *refs;
+static u32 *prev, *next, *ring, *counts, *heap, *heapPos;
+
+static u64 replayLru(u64 budget)
+{
+	// a list through prev and next, glyphNum is its head
+	u32 head = glyphNum;
+	prev[head] = next[head] = head;
+	memset(present, 0, glyphNum);
+
+	u64 used = 0, hit = 0;
+	for (u32 n = 0; n < streamLen; n++) {
+		u32 g = stream[n];
+		if (present[g]) {
+			hit++;
+			next[prev[g]] = next[g];
+			prev[next[g]] = prev[g];
+		} else {
+			for (; used + glyphCost(g) > budget && prev[head] != head;) {
+				u32 old = prev[head];
+				next[prev[old]] = head;
+				prev[head] = prev[old];
+				present[old] = 0;
+				used -= glyphCost(old);
+			}
+			if (used + glyphCost(g) > budget) continue;
+
+			present[g] = 1;
+			used += glyphCost(g);
+		}
+
+		next[g] = next[head];
+		prev[g] = head;
+		prev[next[head]] = g;
+		next[head] = g;
+	}
+	return hit;
+}
+
+// second chance in insertion order, which is what the hand sweeping the slots of fbterm does
+static u64 replayClock(u64 budget)
+{
+	memset(present, 0, glyphNum);
+	memset(refs, 0, glyphNum);
+
+	u32 size = glyphNum + 1, first = 0, last = 0;
+	u64 used = 0, hit = 0;
+	for (u32 n = 0; n < streamLen; n++) {
+		u32 g = stream[n];
+		if (present[g]) {
+			hit++;
+			refs[g] = 1;
+			continue;
+		}
+
+		for (; used + glyphCost(g) > budget && first != last;) {
+			u32 old = ring[first];
+			first = (first + 1) % size;
+
+			if (refs[old]) {
+				refs[old] = 0;
+				ring[last] = old;
+				last = (last + 1) % size;
+			} else {
+				present[old] = 0;
+				used -= glyphCost(old);
+			}
+		}
+		if (used + glyphCost(g) > budget) continue;
+
+		present[g] = 1;
+		used += glyphCost(g);
+		ring[last] = g;
+		last = (last + 1) % size;
+	}
+	return hit;
+}
+
+static inline bool heapLess(u32 a, u32 b)
+{
+	return counts[heap[a]] < counts[heap[b]];
+}
+
+static void heapSwap(u32 a, u32 b)
+{
+	u32 t = heap[a];
+	heap[a] = heap[b];
+	heap[b] = t;
+	heapPos[heap[a]] = a;
+	heapPos[heap[b]] = b;
+}
+
+static void heapDown(u32 i, u32 num)
+{
+	for (;;) {
+		u32 least = i, l = 2 * i + 1, r = l + 1;
+		if (l < num && heapLess(l, least)) least = l;
+		if (r < num && heapLess(r, least)) least = r;
+		if (least == i) return;
+
+		heapSwap(i, least);
+		i = least;
+	}
+}
+
+static void heapUp(u32 i)
+{
+	for (; i && heapLess(i, (i - 1) / 2); i = (i - 1) / 2) heapSwap(i, (i - 1) / 2);
+}
+
+// least frequently used, counting draws while the glyph is cached
+static u64 replayLfu(u64 budget)
+{
+	memset(present, 0, glyphNum);
+
+	u32 num = 0;
+	u64 used = 0, hit = 0;
+	for (u32 n = 0; n < streamLen; n++) {
+		u32 g = stream[n];
+		if (present[g]) {
+			hit++;
+			counts[g]++;
+			heapDown(heapPos[g], num);
+			continue;
+		}
+
+		for (; used + glyphCost(g) > budget && num;) {
+			u32 old = heap[0];
+			heapSwap(0, --num);
+			heapDown(0, num);
+			present[old] = 0;
+			used -= glyphCost(old);
+		}
+		if (used + glyphCost(g) > budget) continue;
+
+		present[g] = 1;
+		used += glyphCost(g);
+		counts[g] = 1;
+		heap[num] = g;
+		heapPos[g] = num;
+		heapUp(num++);
+	}
+	return hit;
+}
+
+// the best fixed set of glyphs for this stream, the limit for draws that come independently,
+// a real trace can do better by following its locality. glyphs are taken by draws per byte,
+// each misses once when it is first drawn
+static u64 replayStatic(u64 budget)
+{
+	memset(counts, 0, sizeof(u32) * glyphNum);
+	for (u32 n = 0; n < streamLen; n++) counts[stream[n]]++;
+
+	u32 order[2] = { 0, 0 };
+	u64 used = 0, hit = 0;
+
+	// glyphs are sorted by draws, narrow and wide ones are merged by draws per byte
+	for (;;) {
+		for (; order[0] < glyphNum && (glyphs[order[0]].wide || !counts[order[0]]); order[0]++);
+		for (; order[1] < glyphNum && (!glyphs[order[1]].wide || !counts[order[1]]); order[1]++);
+		if (order[0] == glyphNum && order[1] == glyphNum) break;
+
+		u32 pick;
+		if (order[1] == glyphNum) pick = 0;
+		else if (order[0] == glyphNum) pick = 1;
+		else pick = ((u64)counts[order[0]] * slotSizes[1] >= (u64)counts[order[1]] * slotSizes[0] ? 0 : 1);
+
+		u32 g = order[pick]++;
+		if (used + glyphCost(g) > budget) continue;
+
+		used += glyphCost(g);
+		hit += counts[g] - 1;
+	}
+	return hit;
+}
+
+static void replay(u32 len, u32 *budgets, u32 budgetNum)
+{
+	if (traceLen) traceStream(len);
+	else makeStream(len);
+
+	present = new u8[glyphNum];
+	refs = new u8[glyphNum];
+	prev = new u32[glyphNum + 1];
+	next = new u32[glyphNum + 1];
+	ring = new u32[glyphNum + 1];
+	counts = new u32[glyphNum];
+	heap = new u32[glyphNum];
+	heapPos = new u32[glyphNum];
+
+	if (traceLen) printf("\nreplay of %u recorded draws, hit rates:\n", streamLen);
+	else printf("\nno trace in the dumps, replay of %u draws generated from the frequencies, hit rates:\n", streamLen);
+	printf("%10s %8s %8s %8s %8s\n", "budget", "clock", "lru", "lfu", "static");
+	for (u32 i = 0; i < budgetNum; i++) {
+		u64 budget = (u64)budgets[i] << 10;
+		printf("%8uKB %7.2f%% %7.2f%% %7.2f%% %7.2f%%\n", budgets[i],
+			percent(replayClock(budget), streamLen), percent(replayLru(budget), streamLen),
+			percent(replayLfu(budget), streamLen), percent(replayStatic(budget), streamLen));
+	}
+
+	delete[] present;
+	delete[] refs;
+	delete[] prev;
+	delete[] next;
+	delete[] ring;
+	delete[] counts;
+	delete[] heap;
+	delete[] heapPos;
+	delete[] stream;
+}
+
+static void usage()
+{
+	printf("usage: glyphstat [-b budget,...] [-n draws] file...\n"
+		"  -b  cache budgets to replay in KB, 256,512,1024,2048,4096,8192,16384 by default\n"
+		"  -n  number of draws to replay, the whole trace by default, or 2000000 at most\n"
+		"      generated from the frequencies for dumps without a trace\n");
+}
+
+int main(int argc, char **argv)
+{
+	u32 budgets[MAX_BUDGETS] = { 256, 512, 1024, 2048, 4096, 8192, 16384 }, budgetNum = 7;
+	u32 len = 0;
+
+	s32 opt;
+	while ((opt = getopt(argc, argv, "b:n:h")) != -1) {
+		switch (opt) {
+		case 'b': {
+			budgetNum = 0;
+			for (s8 *s = optarg; *s && budgetNum < MAX_BUDGETS;) {
+				budgets[budgetNum] = strtoul(s, &s, 10);
+				if (budgets[budgetNum]) budgetNum++;
+				if (*s) s++;
+			}
+			break;
+		}
+
+		case 'n':
+			len = strtoul(optarg, 0, 10);
+			break;
+
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage();
+		return 1;
+	}
+
+	glyphIndex = new u32[MAX_CODE];
+	memset(glyphIndex, 0, sizeof(u32) * MAX_CODE);
+
+	for (s32 i = optind; i < argc; i++) {
+		if (!readStats(argv[i])) return 1;
+	}
+
+	if (!glyphNum || !slotSizes[0]) {
+		fprintf(stderr, "glyphstat: no glyph draws recorded\n");
+		return 1;
+	}
+
+	qsort(glyphs, glyphNum, sizeof(GlyphUse), compareDraws);
+	for (u32 i = 0; i < glyphNum; i++) glyphIndex[glyphs[i].unicode] = i + 1;
+
+	showSummary();
+	showBlocks();
+
+	if (!len) len = (traceLen ? traceLen : (totalDraws < 2000000 ? totalDraws : 2000000));
+	replay(len, budgets, budgetNum);
+
+	delete[] glyphIndex;
+	free(glyphs);
+	free(trace);
+	return 0;
+}
@@ -30,7 +30,7 @@ On startup, FbTerm forks a child process and executes the input method server pr
 method server will communicate each other with a unix socket pair created by FbTerm. When IM server startup, it sends
 a Connect message to FbTerm, indicates that the server has got ready. FbTerm response a FbTermInfo message, tell
 IM server things like current screen size, font size, rotation etc, help IM server draw it's UI. Of course,
-IM server may ignore these hints.
+IM server may ignore these hints. FbTermInfo is sent again whenever the font is zoomed.
 
 When FbTerm exit, it sends a Disconnect to IM server, indicates it to exit.
 
@@ -209,6 +209,12 @@ void ImProxy::sendInfo()
 	write((s8 *)&msg, sizeof(msg));
 }
 
+// the server is told the new cell size like after connecting
+void ImProxy::fontChanged()
+{
+	if (mConnected) sendInfo();
+}
+
 void ImProxy::sendAckWin()
 {
 	Message msg;
@@ -437,12 +443,17 @@ void ImProxy::waitImMessage(u32 type)
 	timeval tv = {2, 0};
 
 	while (1) {
-		fd_set fds;
+		fd_set fds, wfds;
 		FD_ZERO(&fds);
 		FD_SET(fd(), &fds);
 
-		s32 ret = select(fd() + 1, &fds, 0, 0, &tv);
+		// the message answered may still be queued
+		FD_ZERO(&wfds);
+		if (writePending()) FD_SET(fd(), &wfds);
+
+		s32 ret = select(fd() + 1, &fds, &wfds, 0, &tv);
 
+		if (ret > 0 && FD_ISSET(fd(), &wfds)) ready(false);
 		if (ret > 0 && FD_ISSET(fd(), &fds)) ready(true);
 		if ((ret == -1 && errno != EINTR) || !ret || mMsgWaitState == GotMessage) break;
 	};
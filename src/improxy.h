@@ -40,6 +40,7 @@ public:
 	void changeTermMode(bool crlf, bool appkey, bool curo);
 	void switchVt(bool enter, ImProxy *peer);
 	void redrawImWin(const Rectangle &rect);
+	void fontChanged();
 
 private:
 	virtual void readyRead(s8 *buf, u32 len);
@@ -135,6 +135,8 @@ void TtyInput::setupSysKey(bool restore)
 		{T_CTRL_ALT, KEY_F5,       CTRL_ALT_F5},
 		{T_CTRL_ALT, KEY_F6,       CTRL_ALT_F6},
 		{T_CTRL_ALT, KEY_K,       CTRL_ALT_K},
+		{T_CTRL_ALT, KEY_EQUAL,    CTRL_ALT_EQUAL},
+		{T_CTRL_ALT, KEY_MINUS,    CTRL_ALT_MINUS},
 	};
 
 	if (!syskey_saved && restore) return;
@@ -50,7 +50,9 @@ enum Keys {
 	CTRL_ALT_F5,
 	CTRL_ALT_F6,
 	CTRL_ALT_K,
-	AC_END = CTRL_ALT_K
+	CTRL_ALT_EQUAL,
+	CTRL_ALT_MINUS,
+	AC_END = CTRL_ALT_MINUS
 };
 
 #endif
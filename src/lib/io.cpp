@@ -25,9 +25,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
-#include <time.h>
+#include <sys/uio.h>
 #include "io.h"
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 DEFINE_INSTANCE(IoDispatcher)
 
 IoDispatcher::IoDispatcher()
@@ -64,10 +66,18 @@ IoPipe::IoPipe()
 	mCodecWrite = 0;
 	mBufLenRead = 0;
 	mBufLenWrite = 0;
+
+	mWriteHead = mWriteTail = 0;
+	mWriteLen = 0;
+	mBacklog = false;
+	pthread_mutex_init(&mWriteLock, 0);
 }
 
 IoPipe::~IoPipe()
 {
+	dropWrite();
+	pthread_mutex_destroy(&mWriteLock);
+
 	if (mFd != -1) {
 		IoDispatcher::instance()->removeIoSource(this, true);
 		close(mFd);
@@ -86,6 +96,9 @@ void IoPipe::setFd(s32 fd)
 {
 	if (fd == mFd) return;
 
+	// output still queued for the old fd is given up with it
+	dropWrite();
+
 	if (mFd != -1) {
 		IoDispatcher::instance()->removeIoSource(this, true);
 		close(mFd);
@@ -127,12 +140,16 @@ void IoPipe::setCodec(const s8 *up, const s8 *down)
 
 #define BUF_SIZE 10240
 
-void IoPipe::ready(bool isread)
+u32 IoPipe::ready(bool isread)
 {
-	if (!isread) return;
+	if (!isread) {
+		flushWrite();
+		return 0;
+	}
 
 	s8 buf[BUF_SIZE];
 	s32 len = read(mFd, buf + mBufLenRead, sizeof(buf) - mBufLenRead);
+	u32 got = (len > 0 ? len : 0);
 
 	if (!len) {
 		ioError(true, 0); // end of file
@@ -149,6 +166,8 @@ void IoPipe::ready(bool isread)
 
 		translate(true, buf, len);
 	}
+
+	return got;
 }
 
 void IoPipe::write(s8 *buf, u32 len)
@@ -223,27 +242,149 @@ void IoPipe::translate(bool isread, s8 *buf, u32 len)
 	}
 }
 
+// output the fd doesn't take at once is queued in chained chunks and written when it becomes
+// writable, the event loop never waits for it. later small writes are appended to the last
+// chunk and go out together with it
+#define WRITE_CHUNK 4096
+#define WRITE_IOVS 16
+#define WRITE_BACKLOG (64 * 1024)
+
+struct IoPipe::WriteChunk {
+	WriteChunk *next;
+	u32 start, end;
+	s8 data[WRITE_CHUNK];
+};
+
 void IoPipe::writeIo(s8 *buf, u32 len)
 {
-	u32 num = 5;
+	s32 err = 0;
+	pthread_mutex_lock(&mWriteLock);
 
-	while (len) {
+	// queued output goes first
+	while (len && !mWriteHead) {
 		s32 ret = ::write(mFd, buf, len);
-		if (ret == -1) {
-			if (errno == EAGAIN) {
-				if (num--) {
-					timespec tm = { 0, 200 * 1000000UL };
-					nanosleep(&tm, 0);
-				} else break;
-			} else {
-				if (errno != EINTR) {
-					ioError(false, errno);
-				}
-				break;
-			}
-		} else if (ret > 0) {
+		if (ret > 0) {
 			buf += ret;
 			len -= ret;
+		} else if (ret == -1 && errno == EINTR) {
+			continue;
+		} else {
+			if (ret == -1 && errno != EAGAIN) err = errno;
+			break;
 		}
 	}
+
+	if (len && !err) queueWrite(buf, len);
+
+	bool full = (!mBacklog && mWriteLen > WRITE_BACKLOG);
+	if (full) mBacklog = true;
+	pthread_mutex_unlock(&mWriteLock);
+
+	if (err) ioError(false, err);
+	if (full) writeBacklog(true);
+}
+
+void IoPipe::queueWrite(s8 *buf, u32 len)
+{
+	if (!mWriteHead) IoDispatcher::instance()->addIoSource(this, false);
+	mWriteLen += len;
+
+	while (len) {
+		WriteChunk *chunk = mWriteTail;
+		if (!chunk || chunk->end == WRITE_CHUNK) {
+			chunk = new WriteChunk;
+			chunk->next = 0;
+			chunk->start = chunk->end = 0;
+
+			if (mWriteTail) mWriteTail->next = chunk;
+			else mWriteHead = chunk;
+			mWriteTail = chunk;
+		}
+
+		u32 num = MIN(len, WRITE_CHUNK - chunk->end);
+		memcpy(chunk->data + chunk->end, buf, num);
+		chunk->end += num;
+		buf += num;
+		len -= num;
+	}
+}
+
+void IoPipe::flushWrite()
+{
+	s32 err = 0;
+	pthread_mutex_lock(&mWriteLock);
+
+	if (!mWriteHead) {
+		pthread_mutex_unlock(&mWriteLock);
+		return;
+	}
+
+	while (mWriteHead) {
+		iovec iov[WRITE_IOVS];
+		u32 num = 0;
+		for (WriteChunk *chunk = mWriteHead; chunk && num < WRITE_IOVS; chunk = chunk->next, num++) {
+			iov[num].iov_base = chunk->data + chunk->start;
+			iov[num].iov_len = chunk->end - chunk->start;
+		}
+
+		ssize_t ret = writev(mFd, iov, num);
+		if (ret == -1 && errno == EINTR) continue;
+		if (ret <= 0) {
+			if (ret == -1 && errno != EAGAIN) err = errno;
+			break;
+		}
+
+		mWriteLen -= ret;
+		while (ret) {
+			WriteChunk *chunk = mWriteHead;
+			u32 done = MIN((u32)ret, chunk->end - chunk->start);
+			chunk->start += done;
+			ret -= done;
+
+			if (chunk->start == chunk->end) {
+				mWriteHead = chunk->next;
+				delete chunk;
+			}
+		}
+	}
+
+	if (!mWriteHead) mWriteTail = 0;
+
+	// nothing more can be written to a broken fd
+	bool drained = (!mWriteHead || err);
+	if (drained) IoDispatcher::instance()->removeIoSource(this, false);
+
+	bool resume = (mBacklog && (drained || mWriteLen < WRITE_BACKLOG / 2));
+	if (resume) mBacklog = false;
+	pthread_mutex_unlock(&mWriteLock);
+
+	if (err) {
+		dropWrite();
+		ioError(false, err);
+	}
+	if (resume) writeBacklog(false);
+}
+
+void IoPipe::dropWrite()
+{
+	pthread_mutex_lock(&mWriteLock);
+
+	while (mWriteHead) {
+		WriteChunk *chunk = mWriteHead;
+		mWriteHead = chunk->next;
+		delete chunk;
+	}
+
+	mWriteTail = 0;
+	mWriteLen = 0;
+	mBacklog = false;
+	pthread_mutex_unlock(&mWriteLock);
+}
+
+u32 IoPipe::writePending()
+{
+	pthread_mutex_lock(&mWriteLock);
+	u32 len = mWriteLen;
+	pthread_mutex_unlock(&mWriteLock);
+	return len;
 }
@@ -21,6 +21,7 @@
 #ifndef IO_H
 #define IO_H
 
+#include <pthread.h>
 #include "type.h"
 #include "instance.h"
 
@@ -30,7 +31,10 @@ public:
 	virtual ~IoPipe();
 
 	s32 fd() { return mFd; }
-	void ready(bool isread);
+	u32 ready(bool isread);
+
+	// bytes written but not taken by the fd yet
+	u32 writePending();
 
 	static const s8 *localCodec();
 
@@ -42,19 +46,34 @@ protected:
 	virtual void readyRead(s8 *buf, u32 len) = 0;
 	virtual void ioError(bool read, s32 err) {}
 
+	// output queued for the fd went beyond a limit or fell below half of it again,
+	// whatever feeds this pipe can stop and resume
+	virtual void writeBacklog(bool full) {}
+
 private:
+	struct WriteChunk;
+
 	void translate(bool isread, s8 *buf, u32 len);
 	void writeIo(s8 *buf, u32 len);
+	void queueWrite(s8 *buf, u32 len);
+	void flushWrite();
+	void dropWrite();
 
 	s32 mFd;
 	void *mCodecRead, *mCodecWrite;
 	s8 mBufRead[16], mBufWrite[16];
 	u32 mBufLenRead, mBufLenWrite;
+
+	WriteChunk *mWriteHead, *mWriteTail;
+	u32 mWriteLen;
+	bool mBacklog;
+	pthread_mutex_t mWriteLock;
 };
 
 class IoDispatcher {
 	DECLARE_INSTANCE(IoDispatcher)
 private:
+	// isread false watches an added source for being writable, or stops it
 	virtual void addIoSource(IoPipe *src, bool isread) = 0;
 	virtual void removeIoSource(IoPipe *src, bool isread) = 0;
 
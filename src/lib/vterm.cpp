@@ -508,12 +508,21 @@ void VTerm::update()
 	}
 	pending_scroll = 0;
 
-	for (u16 i = 0; i < height; i++) {
-		if (dirty_endx[i] >= dirty_startx[i]) {
-			requestUpdate(dirty_startx[i], i, dirty_endx[i] - dirty_startx[i] + 1, 1);
-			dirty_startx[i] = width;
-			dirty_endx[i] = 0;
+	for (u16 i = 0; i < height;) {
+		if (dirty_endx[i] < dirty_startx[i]) {
+			i++;
+			continue;
+		}
+
+		// merge following lines with the same dirty range into one update
+		u16 start = dirty_startx[i], end = dirty_endx[i], num;
+		for (num = 0; i + num < height && dirty_startx[i + num] == start && dirty_endx[i + num] == end; num++) {
+			dirty_startx[i + num] = width;
+			dirty_endx[i + num] = 0;
 		}
+
+		requestUpdate(start, i, end - start + 1, num);
+		i += num;
 	}
 }
 
@@ -541,38 +550,105 @@ void VTerm::expose(u16 x, u16 y, u16 w, u16 h)
 	if (x + w > width) w = width - x;
 	if (y + h > height) h = height - y;
 
+	CharAttr blank_attr;
+	u16 blank_y = y, blank_h = 0;
+
 	for (; h--; y++) {
 		u32 yp = get_line(y) * max_width;
 
-		u16 startx = x;
-		u16 endx = x + w - 1;
+		// collect consecutive blank lines, they are cleared as one rectangle
+		if (blank_line(yp + x, w)) {
+			if (blank_h && attrs[yp + x] != blank_attr) {
+				clear_lines(blank_attr, x, blank_y, w, blank_h);
+				blank_h = 0;
+			}
 
-		if (attrs[yp + startx].type == CharAttr::DoubleRight) startx--;
-		if (attrs[yp + endx].type == CharAttr::DoubleLeft) endx++;
+			if (!blank_h) {
+				blank_attr = attrs[yp + x];
+				blank_y = y;
+			}
+			blank_h++;
+			continue;
+		}
 
-		CharAttr attr = attrs[yp + startx];
-		bool dws[width];
-		u16 codes[width], num = 0;
-		u16 cur, start = startx;
+		if (blank_h) {
+			clear_lines(blank_attr, x, blank_y, w, blank_h);
+			blank_h = 0;
+		}
 
-		for (cur = startx; cur <= endx; cur++) {
-			if (attrs[yp + cur].type == CharAttr::DoubleRight) continue;
+		exposeLine(y, x, w, text + yp, attrs + yp, mode_flags.inverse_screen);
+	}
 
-			if (attrs[yp + cur] != attr) {
-				attr.reverse ^= mode_flags.inverse_screen;
-				drawChars(attr, start, y, cur - start, num, codes, dws);
+	if (blank_h) clear_lines(blank_attr, x, blank_y, w, blank_h);
+}
 
-				num = 0;
-				start = cur;
-				attr = attrs[yp + cur];
-			}
+// draw columns [x, x + w) of line y from a copy of its cells, which may be older than the current content
+void VTerm::exposeLine(u16 y, u16 x, u16 w, u16 *line_text, CharAttr *line_attrs, bool inverse)
+{
+	u16 startx = x;
+	u16 endx = x + w - 1;
+
+	if (line_attrs[startx].type == CharAttr::DoubleRight) startx--;
+	if (line_attrs[endx].type == CharAttr::DoubleLeft) endx++;
 
-			dws[num] = (attrs[yp + cur].type != CharAttr::Single);
-			codes[num++] = text[yp + cur];
+	CharAttr attr = line_attrs[startx];
+	bool dws[width];
+	u16 codes[width], num = 0;
+	u16 cur, start = startx;
+
+	for (cur = startx; cur <= endx; cur++) {
+		if (line_attrs[cur].type == CharAttr::DoubleRight) continue;
+
+		if (line_attrs[cur] != attr) {
+			attr.reverse ^= inverse;
+			drawChars(attr, start, y, cur - start, num, codes, dws);
+
+			num = 0;
+			start = cur;
+			attr = line_attrs[cur];
 		}
 
-		attr.reverse ^= mode_flags.inverse_screen;
-		drawChars(attr, start, y, cur - start, num, codes, dws);
+		dws[num] = (line_attrs[cur].type != CharAttr::Single);
+		codes[num++] = line_text[cur];
+	}
+
+	attr.reverse ^= inverse;
+	drawChars(attr, start, y, cur - start, num, codes, dws);
+}
+
+void VTerm::copyLine(u16 y, u16 *line_text, CharAttr *line_attrs)
+{
+	u32 yp = get_line(y) * max_width;
+	memcpy(line_text, text + yp, width * sizeof(u16));
+	memcpy(line_attrs, attrs + yp, width * sizeof(CharAttr));
+}
+
+bool VTerm::blank_line(u32 yp, u16 w)
+{
+	CharAttr attr = attrs[yp];
+	for (u32 end = yp + w; yp < end; yp++) {
+		if (text[yp] != 0x20 || attrs[yp].type != CharAttr::Single || attrs[yp] != attr) return false;
+	}
+	return true;
+}
+
+void VTerm::clear_lines(CharAttr attr, u16 x, u16 y, u16 w, u16 h)
+{
+	attr.reverse ^= mode_flags.inverse_screen;
+	clearChars(attr, x, y, w, h);
+}
+
+void VTerm::clearChars(CharAttr attr, u16 x, u16 y, u16 w, u16 h)
+{
+	bool dws[w];
+	u16 codes[w];
+	for (u16 i = 0; i < w; i++) {
+		dws[i] = false;
+		codes[i] = 0x20;
+	}
+
+	for (; h--; y++) {
+		drawChars(attr, x, y, w, w, codes, dws);
 	}
 }
 
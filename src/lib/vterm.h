@@ -82,16 +82,20 @@ public:
 	void resize(u16 w, u16 h);
 	void input(const u8 *buf, u32 count);
 	void expose(u16 x, u16 y, u16 w, u16 h);
+	void exposeLine(u16 y, u16 x, u16 w, u16 *line_text, CharAttr *line_attrs, bool inverse);
+	void copyLine(u16 y, u16 *line_text, CharAttr *line_attrs);
 	void inverse(u16 sx, u16 sy, u16 ex, u16 ey);
 
 	u16 charCode(u16 x, u16 y) { return text[get_line(y) * max_width + x]; }
 	CharAttr charAttr(u16 x, u16 y) { return attrs[get_line(y) * max_width + x]; }
+	bool inverseScreen() { return mode_flags.inverse_screen; }
 
 	static s32 charWidth(u32 ucs);
 
 protected:
 	virtual void drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws) = 0;
 	virtual bool moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h) { return false; }
+	virtual void clearChars(CharAttr attr, u16 x, u16 y, u16 w, u16 h);
 	virtual void drawCursor(CharAttr attr, u16 x, u16 y, u16 c) {}
 	virtual void sendBack(const s8 *data) {}
 	virtual void modeChanged(ModeType type) {}
@@ -107,6 +111,8 @@ private:
 	void shift_text(u16 y, u16 start_x, u16 end_x, s16 num); // ditto
 	void clear_area(u16 start_x, u16 start_y, u16 end_x, u16 end_y);
 	void changed_line(u16 y, u16 start_x, u16 end_x);
+	bool blank_line(u32 yp, u16 w);
+	void clear_lines(CharAttr attr, u16 x, u16 y, u16 w, u16 h);
 	void move_cursor(u16 x, u16 y);
 	void update();
 	void draw_cursor();
@@ -0,0 +1,217 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <signal.h>
+#include "pipeline.h"
+#include "screen.h"
+#include "fbconfig.h"
+
+#define FRESH 0x80000000
+
+DEFINE_INSTANCE(RenderPipeline)
+
+RenderPipeline *RenderPipeline::createInstance()
+{
+	bool enable = false;
+	Config::instance()->getOption("render-pipeline", enable);
+	if (!enable) return 0;
+
+	return new RenderPipeline();
+}
+
+RenderPipeline::RenderPipeline()
+{
+	mVersions = 0;
+	allocLines();
+
+	mPaintedShape = 0;
+	mBack = 0;
+	mFront = 1;
+	mReady = 2;
+	mBusy = 0;
+	mQuit = false;
+
+	sem_init(&mWake, 0, 0);
+	pthread_mutex_init(&mIdleLock, 0);
+	pthread_cond_init(&mIdle, 0);
+
+	// signals are handled by the main thread only
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_create(&mThread, 0, threadEntry, this);
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+RenderPipeline::~RenderPipeline()
+{
+	drain();
+
+	mQuit = true;
+	sem_post(&mWake);
+	pthread_join(mThread, 0);
+	sem_destroy(&mWake);
+	pthread_mutex_destroy(&mIdleLock);
+	pthread_cond_destroy(&mIdle);
+
+	freeLines();
+}
+
+// line buffers for the screen's text grid, called while the render thread is idle
+void RenderPipeline::allocLines()
+{
+	if (mVersions) {
+		drain();
+		freeLines();
+	}
+
+	mCols = Screen::instance()->cols();
+	mRows = Screen::instance()->rows();
+
+	for (u32 i = 0; i < 3; i++) {
+		Snapshot &snap = mSnaps[i];
+		snap.shell = 0;
+		snap.text = new u16[mCols * mRows];
+		snap.attrs = new VTerm::CharAttr[mCols * mRows];
+		snap.versions = new u32[mRows];
+		memset(snap.versions, 0, sizeof(u32) * mRows);
+	}
+
+	mVersions = new u32[mRows];
+	mPainted = new u32[mRows];
+	for (u32 i = 0; i < mRows; i++) {
+		mVersions[i] = 1;
+		mPainted[i] = 0;
+	}
+
+	mShell = 0;
+}
+
+void RenderPipeline::freeLines()
+{
+	for (u32 i = 0; i < 3; i++) {
+		delete[] mSnaps[i].text;
+		delete[] mSnaps[i].attrs;
+		delete[] mSnaps[i].versions;
+	}
+
+	delete[] mVersions;
+	delete[] mPainted;
+}
+
+void RenderPipeline::damage(u16 y, u16 h)
+{
+	for (; h-- && y < mRows; y++) {
+		mVersions[y]++;
+	}
+}
+
+void RenderPipeline::publish(FbShell *shell)
+{
+	// everything is repainted after switching shells
+	if (shell != mShell) {
+		mShell = shell;
+		damage(0, mRows);
+	}
+
+	Snapshot &snap = mSnaps[mBack];
+	snap.shell = shell;
+
+	for (u16 y = 0; y < mRows; y++) {
+		if (snap.versions[y] == mVersions[y]) continue;
+
+		shell->copyLine(y, snap.text + y * mCols, snap.attrs + y * mCols);
+		snap.versions[y] = mVersions[y];
+	}
+
+	snap.inverse = shell->inverseScreen();
+	snap.cursorVisible = shell->mode(VTerm::CursorVisible);
+	snap.cursorShape = shell->cursorShape();
+	snap.cursor = shell->mCursor;
+
+	mBack = __atomic_exchange_n(&mReady, mBack | FRESH, __ATOMIC_SEQ_CST) & ~FRESH;
+	sem_post(&mWake);
+}
+
+void RenderPipeline::drain()
+{
+	if (!(__atomic_load_n(&mReady, __ATOMIC_SEQ_CST) & FRESH) && !__atomic_load_n(&mBusy, __ATOMIC_SEQ_CST)) return;
+
+	// the render thread signals under the lock after each frame, it can't be missed between the check and the wait
+	pthread_mutex_lock(&mIdleLock);
+	while ((__atomic_load_n(&mReady, __ATOMIC_SEQ_CST) & FRESH) || __atomic_load_n(&mBusy, __ATOMIC_SEQ_CST)) {
+		pthread_cond_wait(&mIdle, &mIdleLock);
+	}
+	pthread_mutex_unlock(&mIdleLock);
+}
+
+void *RenderPipeline::threadEntry(void *arg)
+{
+	((RenderPipeline *)arg)->run();
+	return 0;
+}
+
+void RenderPipeline::run()
+{
+	while (1) {
+		sem_wait(&mWake);
+		if (mQuit) break;
+
+		// mark busy before taking the snapshot, drain() must not see it taken but not busy
+		__atomic_store_n(&mBusy, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&mReady, __ATOMIC_SEQ_CST) & FRESH) {
+			mFront = __atomic_exchange_n(&mReady, mFront, __ATOMIC_SEQ_CST) & ~FRESH;
+			paint(&mSnaps[mFront]);
+		}
+
+		__atomic_store_n(&mBusy, 0, __ATOMIC_SEQ_CST);
+
+		pthread_mutex_lock(&mIdleLock);
+		pthread_cond_broadcast(&mIdle);
+		pthread_mutex_unlock(&mIdleLock);
+	}
+}
+
+void RenderPipeline::paint(Snapshot *snap)
+{
+	FbShell *shell = snap->shell;
+	bool cursor_line = false;
+
+	for (u16 y = 0; y < mRows; y++) {
+		if (snap->versions[y] == mPainted[y]) continue;
+		mPainted[y] = snap->versions[y];
+
+		shell->exposeLine(y, 0, mCols, snap->text + y * mCols, snap->attrs + y * mCols, snap->inverse);
+		if (y == snap->cursor.y) cursor_line = true;
+	}
+
+	FbShell::Cursor &cursor = snap->cursor, &last = mPaintedCursor;
+	bool moved = cursor.x != last.x || cursor.y != last.y || cursor.code != last.code
+		|| cursor.showed != last.showed || cursor.attr != last.attr || snap->cursorShape != mPaintedShape;
+
+	if (snap->cursorVisible && (cursor_line || moved)) {
+		shell->paintCursor(cursor, snap->cursorShape);
+	}
+
+	mPaintedCursor = cursor;
+	mPaintedShape = snap->cursorShape;
+}
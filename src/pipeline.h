@@ -0,0 +1,91 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "type.h"
+#include "instance.h"
+#include "fbshell.h"
+
+// optional render thread: the main thread parses shell output and publishes snapshots of
+// the changed lines, the render thread paints the latest snapshot at its own pace.
+// snapshots are handed over through three buffers and a single atomic index, lines whose
+// version differs from the painted one are repainted, so missed snapshots are coalesced.
+class RenderPipeline {
+	DECLARE_INSTANCE(RenderPipeline)
+public:
+	void damage(u16 y, u16 h);
+	void publish(FbShell *shell);
+
+	// the screen already shows this shell, its lines are repainted once damaged again
+	void adopt(FbShell *shell) {
+		mShell = shell;
+	}
+
+	// wait until everything published is painted, before painting from the main thread
+	static void sync() {
+		if (mpRenderPipeline) mpRenderPipeline->drain();
+	}
+
+	// the text grid changed size, the next snapshot repaints everything
+	static void resize() {
+		if (mpRenderPipeline) mpRenderPipeline->allocLines();
+	}
+
+private:
+	struct Snapshot {
+		FbShell *shell;
+		u16 *text;
+		VTerm::CharAttr *attrs;
+		u32 *versions;
+		bool inverse;
+		bool cursorVisible;
+		u16 cursorShape;
+		FbShell::Cursor cursor;
+	};
+
+	static void *threadEntry(void *arg);
+	void run();
+	void paint(Snapshot *snap);
+	void drain();
+	void allocLines();
+	void freeLines();
+
+	u16 mCols, mRows;
+	Snapshot mSnaps[3];
+	u32 mBack, mFront;
+	u32 mReady, mBusy;
+	bool mQuit;
+
+	u32 *mVersions, *mPainted;
+	FbShell *mShell;
+	FbShell::Cursor mPaintedCursor;
+	u16 mPaintedShape;
+
+	pthread_t mThread;
+	sem_t mWake;
+	pthread_mutex_t mIdleLock;
+	pthread_cond_t mIdle;
+};
+
+#endif
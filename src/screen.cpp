@@ -132,6 +132,7 @@ void Screen::showInfo(bool verbose)
 	};
 	printf("[screen] driver: %s, mode: %dx%d-%dbpp, scrolling: %s\n",
 		drvId(), mWidth, mHeight, mBitsPerPixel, scrollstr[mScrollType]);
+	showStoreInfo();
 }
 
 void Screen::switchVc(bool enter)
@@ -143,9 +144,27 @@ void Screen::switchVc(bool enter)
 	if (enter && mPalette) eraseMargin(true, mRows);
 }
 
+// the font was zoomed, the text grid is laid out again with the new cell size.
+// panning starts over, row offsets of the old cells don't fit the new ones
+void Screen::fontChanged()
+{
+	mCols = mWidth / FW(1);
+	mRows = mHeight / FH(1);
+
+	mOffsetCur = 0;
+	setupOffset();
+
+	// panning would move the background image with the text, it stays redrawn
+	if (!hasBackground()) setupScroll();
+
+	if (mPalette) eraseMargin(true, mRows);
+}
+
 bool Screen::move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h)
 {
-	if (!mScrollEnable || mScrollType == Redraw || scol != dcol) return false;
+	if (!mScrollEnable || scol != dcol) return false;
+
+	if (mScrollType == Redraw) return copyRect(scol, srow, drow, w, h);
 
 	u16 top = MIN(srow, drow), bot = MAX(srow, drow) + h;
 	u16 left = scol, right = scol + w;
@@ -153,18 +172,18 @@ bool Screen::move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h)
 	u32 noaccel_redraw_area = w * (bot - top - 1);
 	u32 accel_redraw_area = mCols * mRows - w * h;
 
-	if (noaccel_redraw_area <= accel_redraw_area) return false;
+	if (noaccel_redraw_area <= accel_redraw_area) return copyRect(scol, srow, drow, w, h);
 
 	if (mRotateType == Rotate0 || mRotateType == Rotate270) mOffsetCur += FH((s32)srow - drow);
 	else mOffsetCur -= FH((s32)srow - drow);
 
-	bool redraw_all = false;
 	if (mScrollType == YPan || mScrollType == XPan) {
-		redraw_all = true;
-
-		if (mOffsetCur < 0) mOffsetCur = mOffsetMax;
-		else if ((u32)mOffsetCur > mOffsetMax) mOffsetCur = 0;
-		else redraw_all = false;
+		// panned past an end of video memory, copy what stays visible to the other end and pan there
+		if (mOffsetCur < 0 || (u32)mOffsetCur > mOffsetMax) {
+			s32 to = (mOffsetCur < 0) ? mOffsetMax : 0;
+			copyPage(mOffsetCur, to);
+			mOffsetCur = to;
+		}
 	} else {
 		if (mOffsetCur < 0) mOffsetCur += mOffsetMax + 1;
 		else if ((u32)mOffsetCur > mOffsetMax) mOffsetCur -= mOffsetMax + 1;
@@ -177,13 +196,69 @@ bool Screen::move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h)
 	if (left > 0) redraw(0, top, left, bot - top - 1);
 	if (right < mCols) redraw(right, top, mCols - right, bot - top - 1);
 
-	if (redraw_all) {
-		eraseMargin(true, mRows);
+	eraseMargin(drow > srow, drow > srow ? (drow - srow) : (srow - drow));
+	return true;
+}
+
+// copy the page that would be visible at pan offset 'from' to offset 'to', lines of it
+// lying outside video memory are skipped, they are the ones exposed by the move
+void Screen::copyPage(s32 from, s32 to)
+{
+	s32 first = MAX(0, -from), last = MIN((s32)mHeight, (s32)(mOffsetMax + mHeight) - from);
+	if (first >= last) return;
+
+	if (mScrollType == YPan) {
+		bool down = to > from;
+		for (s32 i = first; i < last; i++) {
+			s32 line = down ? first + last - 1 - i : i;
+			moveSpan(mVMemBase + (to + line) * mBytesPerLine, mVMemBase + (from + line) * mBytesPerLine, mBytesPerLine);
+		}
 	} else {
-		eraseMargin(drow > srow, drow > srow ? (drow - srow) : (srow - drow));
+		u32 bytes_per_pixel = (mBitsPerPixel + 7) >> 3;
+		for (u32 y = 0; y < mWidth; y++) {
+			u8 *line = mVMemBase + y * mBytesPerLine;
+			moveSpan(line + (to + first) * bytes_per_pixel, line + (from + first) * bytes_per_pixel,
+				(last - first) * bytes_per_pixel);
+		}
+	}
+}
+
+// move text lines by copying pixels inside video memory, for screens or scroll regions
+// where panning can't be used. only the lines exposed by the move need to be redrawn.
+bool Screen::copyRect(u16 col, u16 srow, u16 drow, u16 w, u16 h)
+{
+	u32 x = FW(col), sy = FH(srow), dy = FH(drow), pw = FW(w), ph = FH(h);
+	if (x >= mWidth || sy >= mHeight || dy >= mHeight) return false;
+	if (x + pw > mWidth) pw = mWidth - x;
+	if (sy + ph > mHeight) ph = mHeight - sy;
+	if (dy + ph > mHeight) ph = mHeight - dy;
+
+	u32 sx = x, dx = x, sw = pw, sh = ph;
+	rotateRect(sx, sy, sw, sh);
+	rotateRect(dx, dy, pw, ph);
+
+	// copy in the direction that never overwrites source lines not read yet
+	bool down = dy > sy;
+	u32 bytes_per_pixel = (mBitsPerPixel + 7) >> 3;
+
+	for (u32 i = 0; i < ph; i++) {
+		u32 line = down ? ph - 1 - i : i;
+		u32 x0 = sx, y0 = sy + line, x1 = dx, y1 = dy + line;
+
+		adjustOffset(x0, y0);
+		adjustOffset(x1, y1);
+		if (mScrollType == YWrap) {
+			if (y0 > mOffsetMax) y0 -= mOffsetMax + 1;
+			if (y1 > mOffsetMax) y1 -= mOffsetMax + 1;
+		}
+
+		if (!moveText(x0, y0, x1, y1, pw)) {
+			moveSpan(mVMemBase + y1 * mBytesPerLine + x1 * bytes_per_pixel,
+				mVMemBase + y0 * mBytesPerLine + x0 * bytes_per_pixel, pw * bytes_per_pixel);
+		}
 	}
 
-	return !redraw_all;
+	return true;
 }
 
 void Screen::eraseMargin(bool top, u16 h)
@@ -199,6 +274,11 @@ void Screen::eraseMargin(bool top, u16 h)
 
 void Screen::drawText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 {
+	if (mRotateType == Rotate0 || mRotateType == Rotate180) {
+		drawRun(x, y, fc, bc, num, text, dw);
+		return;
+	}
+
 	u32 startx, fw = FW(1);
 
 	u16 startnum, *starttext;
@@ -240,12 +320,110 @@ void Screen::drawText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 	}
 }
 
+// draw a text run scanline by scanline instead of glyph by glyph, every scanline of the run
+// (glyph pixels and background between glyphs) is written to video memory from left to right.
+// only usable when text rows are not rotated to columns of video memory.
+void Screen::drawRun(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
+{
+	if (x >= mWidth || y >= mHeight || !num) return;
+
+	u32 h = FH(1);
+	if (y + h > mHeight) h = mHeight - y;
+
+	// a run of spaces only is a plain rectangle fill
+	u16 i;
+	for (i = 0; i < num && text[i] == 0x20; i++);
+	if (i == num) {
+		u32 w = 0;
+		for (i = 0; i < num; i++) w += dw[i] ? FW(2) : FW(1);
+		fillRect(x, y, w, h, bc);
+		return;
+	}
+
+	Font *font = Font::instance();
+	font->holdGlyphs();
+
+	struct RunGlyph {
+		u32 x, y, w, h;
+		s32 pitch;
+		u8 *pixmap;
+		u32 skip;
+		bool mono;
+	} glyphs[num];
+
+	u32 n = 0, endx = x;
+	for (; num-- && endx < mWidth; text++, dw++) {
+		u32 cx = endx, cw = *dw ? FW(2) : FW(1);
+		if (cx + cw > mWidth) cw = mWidth - cx;
+		endx += cw;
+
+		if (*text == 0x20) continue;
+
+		Font::Glyph *glyph = font->getGlyph(*text, *dw);
+		if (!glyph) continue;
+
+		// glyphs are padded to the cell, only clip cells cut by the screen edge
+		u32 width = MIN(cw, (u32)glyph->width), height = MIN(h, (u32)glyph->height);
+
+		RunGlyph &g = glyphs[n++];
+		g.w = width;
+		g.h = height;
+		g.pitch = glyph->pitch;
+		g.mono = glyph->mono;
+
+		if (mRotateType == Rotate0) {
+			g.x = cx;
+			g.y = y;
+			g.pixmap = glyph->pixmap;
+			g.skip = 0;
+		} else {
+			g.x = mWidth - cx - width;
+			g.y = mHeight - y - height;
+			g.pixmap = glyph->pixmap + (glyph->height - height) * glyph->pitch;
+			g.skip = glyph->width - width;
+		}
+	}
+
+	u32 w = endx - x;
+	rotateRect(x, y, w, h);
+
+	// glyphs are in ascending physical x order with Rotate0, descending with Rotate180
+	s32 step = (mRotateType == Rotate0) ? 1 : -1;
+	RunGlyph *first = (mRotateType == Rotate0) ? glyphs : glyphs + n - 1;
+
+	for (u32 row = y; row < y + h; row++) {
+		u32 ox = 0, oy = row;
+		adjustOffset(ox, oy);
+		if (mScrollType == YWrap && oy > mOffsetMax) oy -= mOffsetMax + 1;
+
+		u32 start = x;
+		RunGlyph *g = first;
+		for (u32 i = n; i--; g += step) {
+			if (row < g->y || row >= g->y + g->h) continue;
+
+			if (g->x > start) (this->*fill)(ox + start, oy, g->x - start, bc);
+			u8 *pixmap = g->pixmap + (row - g->y) * g->pitch;
+			if (g->mono) drawBits(ox + g->x, oy, g->w, fc, bc, pixmap, g->skip);
+			else (this->*draw)(ox + g->x, oy, g->w, fc, bc, pixmap + g->skip);
+			start = g->x + g->w;
+		}
+
+		if (x + w > start) (this->*fill)(ox + start, oy, x + w - start, bc);
+	}
+
+	font->releaseGlyphs();
+}
+
 void Screen::drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 {
+	Font::instance()->holdGlyphs();
+
 	for (; num--; text++, dw++) {
 		drawGlyph(x, y, fc, bc, *text, *dw);
 		x += *dw ? FW(2) : FW(1);
 	}
+
+	Font::instance()->releaseGlyphs();
 }
 
 void Screen::adjustOffset(u32 &x, u32 &y)
@@ -263,75 +441,60 @@ void Screen::fillRect(u32 x, u32 y, u32 w, u32 h, u8 color)
 	rotateRect(x, y, w, h);
 	adjustOffset(x, y);
 
-	for (; h--;) {
-		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
-		(this->*fill)(x, y++, w, color);
+	if (mScrollType == YWrap) {
+		if (y > mOffsetMax) {
+			y -= mOffsetMax + 1;
+		} else if (y + h > mOffsetMax + 1) {
+			u32 num = mOffsetMax + 1 - y;
+			fillRows(x, y, w, num, color);
+			y = 0;
+			h -= num;
+		}
 	}
+
+	fillRows(x, y, w, h, color);
 }
 
 void Screen::drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw)
 {
 	if (x >= mWidth || y >= mHeight) return;
 
-	s32 w = (dw ? FW(2) : FW(1)), h = FH(1);
+	u32 w = (dw ? FW(2) : FW(1)), h = FH(1);
 	if (x + w > mWidth) w = mWidth - x;
 	if (y + h > mHeight) h = mHeight - y;
 
-	Font::Glyph *glyph = (Font::Glyph *)Font::instance()->getGlyph(code);
+	Font::Glyph *glyph = Font::instance()->getGlyph(code, dw);
 	if (!glyph) {
 		fillRect(x, y, w, h, bc);
 		return;
 	}
 
-	s32 top = glyph->top;
-	if (top < 0) top = 0;
-
-	s32 left = glyph->left;
-	if ((s32)x + left < 0) left = -x;
-
-	s32 width = glyph->width;
-	if (width > w - left) width = w - left;
-	if ((s32)x + left + width > (s32)mWidth) width = mWidth - ((s32)x + left);
-	if (width < 0) width = 0;
-
-	s32 height = glyph->height;
-	if (height > h - top) height = h - top;
-	if (y + top + height > mHeight) height = mHeight - (y + top);
-	if (height < 0) height = 0;
-
-	if (top) fillRect(x, y, w, top, bc);
-	if (left > 0) fillRect(x, y + top, left, height, bc);
-
-	s32 right = width + left;
-	if (w > right) fillRect((s32)x + right, y + top, w - right, height, bc);
-
-	s32 bot = top + height;
-	if (h > bot) fillRect(x, y + bot, w, h - bot, bc);
-
-	x += left;
-	y += top;
-	if (x >= mWidth || y >= mHeight || !width || !height) return;
+	// glyphs are padded to the cell, drawing one is a single blit
+	u32 width = MIN(w, (u32)glyph->width), height = MIN(h, (u32)glyph->height);
+	if (w > width) fillRect(x + width, y, w - width, h, bc);
+	if (h > height) fillRect(x, y + height, width, h - height, bc);
 
-	u32 nwidth = width, nheight = height;
-	rotateRect(x, y, nwidth, nheight);
+	rotateRect(x, y, width, height);
 
+	// pixels clipped at the start of each row are skipped, which are bits for mono glyphs
 	u8 *pixmap = glyph->pixmap;
-	u32 wdiff = glyph->width - width, hdiff = glyph->height - height;
+	u32 skip = 0, wdiff = glyph->width - MIN(w, (u32)glyph->width), hdiff = glyph->height - MIN(h, (u32)glyph->height);
 
 	if (wdiff) {
-		if (mRotateType == Rotate180) pixmap += wdiff;
+		if (mRotateType == Rotate180) skip += wdiff;
 		else if (mRotateType == Rotate270) pixmap += wdiff * glyph->pitch;
 	}
 
 	if (hdiff) {
-		if (mRotateType == Rotate90) pixmap += hdiff;
+		if (mRotateType == Rotate90) skip += hdiff;
 		else if (mRotateType == Rotate180) pixmap += hdiff * glyph->pitch;
 	}
 
 	adjustOffset(x, y);
-	for (; nheight--; y++, pixmap += glyph->pitch) {
+	for (; height--; y++, pixmap += glyph->pitch) {
 		if ((mScrollType == YWrap) && y > mOffsetMax) y -= mOffsetMax + 1;
-		(this->*draw)(x, y, nwidth, fc, bc, pixmap);
+		if (glyph->mono) drawBits(x, y, width, fc, bc, pixmap, skip);
+		else (this->*draw)(x, y, width, fc, bc, pixmap + skip);
 	}
 }
 
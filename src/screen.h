@@ -53,8 +53,13 @@ public :
 	
 	void enableScroll(bool enable) { mScrollEnable = enable; }
 
+	u32 pageSize();
+	void savePage(u8 *buf);
+	void restorePage(const u8 *buf);
+
 	void showInfo(bool verbose);
 	virtual void switchVc(bool enter);
+	void fontChanged();
 
 protected:
 	u32 mWidth, mHeight;
@@ -74,32 +79,50 @@ protected:
 private:
 	virtual void setupOffset() {}
 	virtual void setupPalette(bool restore) {}
+	virtual void setupScroll() {}
 	virtual const s8 *drvId() = 0;
 
+	bool copyRect(u16 col, u16 srow, u16 drow, u16 w, u16 h);
+	void copyPage(s32 from, s32 to);
 	void eraseMargin(bool top, u16 h);
+	void drawRun(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
 	void drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
 	void drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw);
 	void adjustOffset(u32 &x, u32 &y);
 
 	void initFillDraw();
 	void endFillDraw();
-
+	void initBackground(const s8 *image);
+	bool loadBackground(const s8 *name);
+	bool hasBackground();
+	void calibrate();
+	bool loadCalibration(const s8 *name);
+	void showStoreInfo();
+
+	void fillRows(u32 x, u32 y, u32 w, u32 h, u8 color);
+	void moveSpan(u8 *dst, u8 *src, u32 len);
+	u8 *pageLine(u32 line);
+	bool moveText(u32 sx, u32 sy, u32 dx, u32 dy, u32 w);
 	void fillX(u32 x, u32 y, u32 w, u8 color);
 	void fillXBg(u32 x, u32 y, u32 w, u8 color);
 	void draw8(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
 	void draw15(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
 	void draw16(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
 	void draw32(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw8Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw15Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw16Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw32Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
+	void drawBg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
+	void drawBits(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *bits, u32 skip);
+	void compose8(u32 x, u32 y, u32 w);
+	void compose15(u32 x, u32 y, u32 w);
+	void compose16(u32 x, u32 y, u32 w);
+	void compose32(u32 x, u32 y, u32 w);
 
 	typedef void (Screen::*fillFun)(u32 x, u32 y, u32 w, u8 color);
 	typedef void (Screen::*drawFun)(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
+	typedef void (Screen::*composeFun)(u32 x, u32 y, u32 w);
 
 	fillFun fill;
 	drawFun draw;
+	composeFun compose;
 	bool mScrollEnable;
 };
 #endif
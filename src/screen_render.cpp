@@ -18,14 +18,26 @@
  *
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "screen.h"
+#include "font.h"
 #include "fbconfig.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 #define writeb(addr, val) (*(volatile u8 *)(addr) = (val))
 #define writew(addr, val) (*(volatile u16 *)(addr) = (val))
 #define writel(addr, val) (*(volatile u32 *)(addr) = (val))
+#define writeq(addr, val) (*(volatile u64 *)(addr) = (val))
+
+// spans shorter than this are written with plain stores, longer ones bypass the cache
+#define STREAM_MIN_BYTES 256
 
 static u32 bytes_per_pixel;
 static u32 ppl, ppw, ppb;
@@ -34,28 +46,57 @@ static u32 fillColors[NR_COLORS];
 static u8 *bgimage_mem;
 static u8 bgcolor;
 
+// with a background image, what is drawn goes to a text layer first and every pixel is composed
+// from it and the image. the image is also kept unpacked to rgb, so blending needs no unpacking.
+// both are indexed by pixel offset in video memory.
+struct TextPixel {
+	u8 fc, bc, alpha;
+};
+
+static TextPixel *textLayer;
+static Color *bgimage_rgb;
+
+// for every byte of a mono glyph, the mask selecting the foreground in its 8 expanded pixels
+static u64 monoMasks[256][4];
+
+// ways of writing video memory, the defaults may be replaced by calibrate()
+typedef enum { FillLong = 0, FillSimd, FillStream, NR_FILL_TYPES } FillType;
+typedef enum { DrawDirect = 0, DrawBuffered, NR_DRAW_TYPES } DrawType;
+typedef enum { CopyMemmove = 0, CopyStream, NR_COPY_TYPES } CopyType;
+
+static u32 fillType = FillStream;
+static u32 drawType = DrawDirect;
+static u32 copyType = CopyMemmove;
+static bool calibrated;
+
+// pixel value of a color in 15/16/32bpp direct color modes, 16 bit pixels are doubled
+static u32 packColor(u32 bpp, const Color &c)
+{
+	u32 pixel = 0;
+	switch (bpp) {
+	case 15:
+		pixel = ((c.red >> 3) << 10) | ((c.green >> 3) << 5) | (c.blue >> 3);
+		pixel |= pixel << 16;
+		break;
+	case 16:
+		pixel = ((c.red >> 3) << 11) | ((c.green >> 2) << 5) | (c.blue >> 3);
+		pixel |= pixel << 16;
+		break;
+	case 32:
+		pixel = (c.red << 16) | (c.green << 8) | c.blue;
+		break;
+	}
+	return pixel;
+}
+
 void Screen::setPalette(const Color *palette)
 {
 	if (mPalette == palette) return;
 	mPalette = palette;
 
 	for (u32 i = 0; i < NR_COLORS; i++) {
-		switch (mBitsPerPixel) {
-		case 8:
-			fillColors[i] = (i << 24) | (i << 16) | (i << 8) | i;
-			break;
-		case 15:
-			fillColors[i] = ((palette[i].red >> 3) << 10) | ((palette[i].green >> 3) << 5) | (palette[i].blue >> 3);
-			fillColors[i] |= fillColors[i] << 16;
-			break;
-		case 16:
-			fillColors[i] = ((palette[i].red >> 3) << 11) | ((palette[i].green >> 2) << 5) | (palette[i].blue >> 3);
-			fillColors[i] |= fillColors[i] << 16;
-			break;
-		case 32:
-			fillColors[i] = (palette[i].red << 16) | (palette[i].green << 8) | palette[i].blue;
-			break;
-		}
+		if (mBitsPerPixel == 8) fillColors[i] = (i << 24) | (i << 16) | (i << 8) | i;
+		else fillColors[i] = packColor(mBitsPerPixel, palette[i]);
 	}
 
 	setupPalette(false);
@@ -71,100 +112,404 @@ void Screen::initFillDraw()
 	ppw = ppl >> 1;
 	ppb = ppl >> 2;
 
-	bool bg = false;
-	if (getenv("FBTERM_BACKGROUND_IMAGE")) {
-		bg = true;
-		mScrollType = Redraw;
+	for (u32 i = 0; i < 256; i++) {
+		u8 *mask = (u8 *)monoMasks[i];
+		for (u32 bit = 0; bit < 8; bit++) {
+			memset(mask + bit * bytes_per_pixel, (i & (0x80 >> bit)) ? 0xff : 0, bytes_per_pixel);
+		}
+	}
+
+	fill = &Screen::fillX;
+
+	switch (mBitsPerPixel) {
+	case 8:
+		draw = &Screen::draw8;
+		break;
+	case 15:
+		draw = &Screen::draw15;
+		break;
+	case 16:
+		draw = &Screen::draw16;
+		break;
+	case 32:
+		draw = &Screen::draw32;
+		break;
+	}
+
+	// measured before the background image takes over drawing, the image is taken from the restored screen
+	calibrate();
 
-		u32 color = 0;
-		Config::instance()->getOption("color-background", color);
-		if (color > 7) color = 0;
-		bgcolor = color;
+	const s8 *image = getenv("FBTERM_BACKGROUND_IMAGE");
+	if (image) initBackground(image);
+}
+
+void Screen::initBackground(const s8 *image)
+{
+	mScrollType = Redraw;
+
+	u32 color = 0;
+	Config::instance()->getOption("color-background", color);
+	if (color > 7) color = 0;
+	bgcolor = color;
+
+	u32 size = mBytesPerLine * ((mRotateType == Rotate0 || mRotateType == Rotate180) ? mHeight : mWidth);
+	u32 pixels = size / bytes_per_pixel;
+
+	bgimage_mem = new u8[size];
+	bgimage_rgb = new Color[pixels];
+	textLayer = new TextPixel[pixels];
+
+	for (u32 i = 0; i < pixels; i++) {
+		textLayer[i].fc = textLayer[i].bc = bgcolor;
+		textLayer[i].alpha = 0;
+	}
 
-		u32 size = mBytesPerLine * ((mRotateType == Rotate0 || mRotateType == Rotate180) ? mHeight : mWidth);
-		bgimage_mem = new u8[size];
+	if (loadBackground(image)) {
+		// the image wins over whatever was on the screen
+	} else {
 		memcpy(bgimage_mem, mVMemBase, size);
+
+		for (u32 i = 0; i < pixels && mBitsPerPixel != 8; i++) {
+			u32 pixel = 0;
+			memcpy(&pixel, bgimage_mem + i * bytes_per_pixel, bytes_per_pixel);
+
+			Color &c = bgimage_rgb[i];
+			if (mBitsPerPixel == 32) {
+				c.red = pixel >> 16;
+				c.green = pixel >> 8;
+				c.blue = pixel;
+			} else {
+				u32 lgreen = (mBitsPerPixel == 15 ? 5 : 6);
+				c.red = ((pixel >> (lgreen + 5)) & 0x1f) << 3;
+				c.green = ((pixel >> 5) & ((1 << lgreen) - 1)) << (8 - lgreen);
+				c.blue = (pixel & 0x1f) << 3;
+			}
+		}
 	}
 
-	fill = bg ? &Screen::fillXBg : &Screen::fillX;
+	fill = &Screen::fillXBg;
+	draw = &Screen::drawBg;
 
 	switch (mBitsPerPixel) {
 	case 8:
-		draw = bg ? &Screen::draw8Bg : &Screen::draw8;
+		compose = &Screen::compose8;
 		break;
 	case 15:
-		draw = bg ? &Screen::draw15Bg : &Screen::draw15;
+		compose = &Screen::compose15;
 		break;
 	case 16:
-		draw = bg ? &Screen::draw16Bg : &Screen::draw16;
+		compose = &Screen::compose16;
 		break;
 	case 32:
-		draw = bg ? &Screen::draw32Bg : &Screen::draw32;
+		compose = &Screen::compose32;
 		break;
 	}
 }
 
+bool Screen::hasBackground()
+{
+	return bgimage_mem;
+}
+
+#define MAX_IMAGE_SIZE 16384
+
+// read a binary PPM (P6) image, scaled to the screen as seen by the user
+bool Screen::loadBackground(const s8 *name)
+{
+	if (mBitsPerPixel == 8) return false;
+
+	FILE *file = fopen(name, "r");
+	if (!file) return false;
+
+	u32 w = 0, h = 0, maxval = 0;
+	s8 magic[3] = "";
+	bool ok = (fscanf(file, "%2s", magic) == 1 && !strcmp(magic, "P6"));
+
+	// width, height and maxval, each may be preceded by comment lines
+	u32 *fields[3] = { &w, &h, &maxval };
+	for (u32 i = 0; ok && i < 3; i++) {
+		s32 c;
+		while ((c = fgetc(file)) == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			if (c == '#') while ((c = fgetc(file)) != EOF && c != '\n');
+		}
+		ok = (c != EOF && ungetc(c, file) != EOF && fscanf(file, "%u", fields[i]) == 1);
+	}
+
+	// the sizes come from the file, they are limited so the pixel data size can't wrap
+	ok = ok && w && h && w <= MAX_IMAGE_SIZE && h <= MAX_IMAGE_SIZE && maxval && maxval < 256 && fgetc(file) != EOF;
+
+	u64 bytes = (u64)w * h * 3;
+	u8 *data = ok ? new u8[bytes] : 0;
+	if (data && fread(data, bytes, 1, file) != 1) ok = false;
+	fclose(file);
+
+	if (!ok) {
+		if (data) delete[] data;
+		return false;
+	}
+
+	for (u32 ly = 0; ly < mHeight; ly++) {
+		for (u32 lx = 0; lx < mWidth; lx++) {
+			u8 *src = data + ((u64)ly * h / mHeight * w + (u64)lx * w / mWidth) * 3;
+
+			u32 x = lx, y = ly;
+			rotatePoint(mWidth, mHeight, x, y);
+			u32 offset = y * mBytesPerLine + x * bytes_per_pixel;
+
+			Color &c = bgimage_rgb[offset / bytes_per_pixel];
+			c.red = src[0] * 255 / maxval;
+			c.green = src[1] * 255 / maxval;
+			c.blue = src[2] * 255 / maxval;
+
+			u32 pixel = packColor(mBitsPerPixel, c);
+			memcpy(bgimage_mem + offset, &pixel, bytes_per_pixel);
+		}
+	}
+
+	delete[] data;
+	return true;
+}
+
 void Screen::endFillDraw()
 {
 	if (bgimage_mem) delete[] bgimage_mem;
+	if (bgimage_rgb) delete[] bgimage_rgb;
+	if (textLayer) delete[] textLayer;
 }
 
-void Screen::fillX(u32 x, u32 y, u32 w, u8 color)
+// fill len bytes at dst with the replicated 32 bit color c, dst is always pixel aligned and
+// c holds the same pixel in every position, so the pattern is valid at any pixel address.
+// returns true if non-temporal stores were used, the caller must fence before returning.
+static bool fillSpan(u8 *dst, u32 len, u32 c)
 {
-	u32 c = fillColors[color];
-	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+	// short spans: a few cells of a space run or a margin
+	if (len < 16) {
+		for (; len >= 4; len -= 4, dst += 4) writel(dst, c);
+		if (len & 2) {
+			writew(dst, c);
+			dst += 2;
+		}
+		if (len & 1) writeb(dst, c);
+		return false;
+	}
+
+	// align the destination to 16 bytes
+	if ((unsigned long)dst & 1) {
+		writeb(dst, c);
+		dst++, len--;
+	}
+	if ((unsigned long)dst & 2) {
+		writew(dst, c);
+		dst += 2, len -= 2;
+	}
+	for (; ((unsigned long)dst & 15) && len >= 4; len -= 4, dst += 4) writel(dst, c);
 
-	// get better performance if write-combining not enabled for video memory
-	for (u32 i = w / ppl; i--; dst += 4) {
+	bool stream = false;
+
+#ifdef __SSE2__
+	if (fillType != FillLong) {
+		__m128i v = _mm_set1_epi32(c);
+		if (fillType == FillStream && len >= STREAM_MIN_BYTES) {
+			stream = true;
+			for (; len >= 64; len -= 64, dst += 64) {
+				_mm_stream_si128((__m128i *)dst, v);
+				_mm_stream_si128((__m128i *)(dst + 16), v);
+				_mm_stream_si128((__m128i *)(dst + 32), v);
+				_mm_stream_si128((__m128i *)(dst + 48), v);
+			}
+			for (; len >= 16; len -= 16, dst += 16) _mm_stream_si128((__m128i *)dst, v);
+		} else {
+			for (; len >= 16; len -= 16, dst += 16) _mm_store_si128((__m128i *)dst, v);
+		}
+	}
+#endif
+
+	for (; len >= 16; len -= 16, dst += 16) {
 		writel(dst, c);
+		writel(dst + 4, c);
+		writel(dst + 8, c);
+		writel(dst + 12, c);
 	}
 
-	if (w & ppw) {
+	for (; len >= 4; len -= 4, dst += 4) writel(dst, c);
+	if (len & 2) {
 		writew(dst, c);
 		dst += 2;
 	}
+	if (len & 1) writeb(dst, c);
 
-	if (w & ppb) {
-		writeb(dst, c);
+	return stream;
+}
+
+static inline void fillFence(bool stream)
+{
+#ifdef __SSE2__
+	if (stream) _mm_sfence();
+#endif
+}
+
+void Screen::fillX(u32 x, u32 y, u32 w, u8 color)
+{
+	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+	fillFence(fillSpan(dst, w * bytes_per_pixel, fillColors[color]));
+}
+
+void Screen::fillRows(u32 x, u32 y, u32 w, u32 h, u8 color)
+{
+	if (fill != &Screen::fillX) {
+		for (; h--; y++) (this->*fill)(x, y, w, color);
+		return;
+	}
+
+	u32 c = fillColors[color], len = w * bytes_per_pixel;
+	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+
+	// whole lines are contiguous in video memory, clear them with a single span
+	if (len == mBytesPerLine) {
+		fillFence(fillSpan(dst, len * h, c));
+		return;
+	}
+
+	bool stream = false;
+	for (; h--; dst += mBytesPerLine) {
+		stream |= fillSpan(dst, len, c);
+	}
+	fillFence(stream);
+}
+
+// copy len bytes inside video memory, the spans may overlap
+// copy with SSE2 loads and non-temporal stores, the spans must not overlap
+static void streamCopy(u8 *dst, const u8 *src, u32 len)
+{
+#ifdef __SSE2__
+	for (; ((unsigned long)dst & 15) && len; len--) *dst++ = *src++;
+
+	for (; len >= 64; len -= 64, dst += 64, src += 64) {
+		__m128i a = _mm_loadu_si128((__m128i *)src), b = _mm_loadu_si128((__m128i *)(src + 16));
+		__m128i c = _mm_loadu_si128((__m128i *)(src + 32)), d = _mm_loadu_si128((__m128i *)(src + 48));
+		_mm_stream_si128((__m128i *)dst, a);
+		_mm_stream_si128((__m128i *)(dst + 16), b);
+		_mm_stream_si128((__m128i *)(dst + 32), c);
+		_mm_stream_si128((__m128i *)(dst + 48), d);
+	}
+	for (; len >= 16; len -= 16, dst += 16, src += 16) {
+		_mm_stream_si128((__m128i *)dst, _mm_loadu_si128((__m128i *)src));
+	}
+
+	memcpy(dst, src, len);
+	_mm_sfence();
+#else
+	memcpy(dst, src, len);
+#endif
+}
+
+void Screen::moveSpan(u8 *dst, u8 *src, u32 len)
+{
+	if (copyType == CopyStream && (dst + len <= src || src + len <= dst)) streamCopy(dst, src, len);
+	else memmove(dst, src, len);
+}
+
+// the visible page is saved for inactive shells and written back in one pass when they are
+// switched to. with a background image the text layer would go out of sync, no page is kept.
+u32 Screen::pageSize()
+{
+	if (textLayer) return 0;
+
+	bool rotated = (mRotateType == Rotate90 || mRotateType == Rotate270);
+	return (rotated ? mHeight : mWidth) * bytes_per_pixel * (rotated ? mWidth : mHeight);
+}
+
+u8 *Screen::pageLine(u32 line)
+{
+	u32 x = 0, y = line;
+	adjustOffset(x, y);
+	if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+
+	return mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+}
+
+void Screen::savePage(u8 *buf)
+{
+	bool rotated = (mRotateType == Rotate90 || mRotateType == Rotate270);
+	u32 len = (rotated ? mHeight : mWidth) * bytes_per_pixel, lines = (rotated ? mWidth : mHeight);
+
+	for (u32 line = 0; line < lines; line++, buf += len) {
+		memcpy(buf, pageLine(line), len);
 	}
 }
 
+void Screen::restorePage(const u8 *buf)
+{
+	bool rotated = (mRotateType == Rotate90 || mRotateType == Rotate270);
+	u32 len = (rotated ? mHeight : mWidth) * bytes_per_pixel, lines = (rotated ? mWidth : mHeight);
+
+	for (u32 line = 0; line < lines; line++, buf += len) {
+		streamCopy(pageLine(line), buf, len);
+	}
+}
+
+// with a background image, text pixels are moved in the text layer and composed again at their
+// new place, the image stays where it is. returns false without a background image.
+bool Screen::moveText(u32 sx, u32 sy, u32 dx, u32 dy, u32 w)
+{
+	if (!textLayer) return false;
+
+	memmove(textLayer + (dy * mBytesPerLine) / bytes_per_pixel + dx,
+		textLayer + (sy * mBytesPerLine) / bytes_per_pixel + sx, w * sizeof(TextPixel));
+	(this->*compose)(dx, dy, w);
+	return true;
+}
+
 void Screen::fillXBg(u32 x, u32 y, u32 w, u8 color)
 {
-	if (color == bgcolor) {
-		u32 offset = y * mBytesPerLine + x * bytes_per_pixel;
-		memcpy(mVMemBase + offset, bgimage_mem + offset, w * bytes_per_pixel);
-	} else {
-		fillX(x, y, w, color);
+	TextPixel *text = textLayer + (y * mBytesPerLine) / bytes_per_pixel + x;
+	for (u32 i = 0; i < w; i++) {
+		text[i].fc = text[i].bc = color;
+		text[i].alpha = 0;
 	}
+
+	(this->*compose)(x, y, w);
+}
+
+void Screen::drawBg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap)
+{
+	TextPixel *text = textLayer + (y * mBytesPerLine) / bytes_per_pixel + x;
+	for (u32 i = 0; i < w; i++) {
+		text[i].fc = fc;
+		text[i].bc = bc;
+		text[i].alpha = pixmap[i];
+	}
+
+	(this->*compose)(x, y, w);
 }
 
 void Screen::draw8(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap)
 {
 	bool isfg;
-	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+	u8 *fb = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
 
-	for (; w--; pixmap++, dst++) {
+	// buffered drawing composes the row in cached memory and writes it out with one copy
+	u8 buf[drawType == DrawBuffered ? w : 1];
+	u8 *dst = (drawType == DrawBuffered ? buf : fb);
+
+	for (u32 i = w; i--; pixmap++, dst++) {
 		isfg = (*pixmap & 0x80);
 		writeb(dst, fillColors[isfg ? fc : bc]);
 	}
+
+	if (drawType == DrawBuffered) memcpy(fb, buf, w);
 }
 
-void Screen::draw8Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap)
+void Screen::compose8(u32 x, u32 y, u32 w)
 {
-	if (bc != bgcolor) {
-		draw8(x, y, w, fc, bc, pixmap);
-		return;
-	}
-
-	bool isfg;
-	u32 offset = y * mBytesPerLine + x * bytes_per_pixel;
-	u8 *dst = mVMemBase + offset;
-	u8 *bgimg = bgimage_mem + offset;
+	u32 offset = y * mBytesPerLine + x;
+	u8 *dst = mVMemBase + offset, *bgimg = bgimage_mem + offset;
+	TextPixel *text = textLayer + offset;
 
-	for (; w--; pixmap++, dst++, bgimg++) {
-		isfg = (*pixmap & 0x80);
-		writeb(dst, isfg ? fillColors[fc] : (*bgimg));
+	for (; w--; dst++, bgimg++, text++) {
+		if (text->alpha & 0x80) writeb(dst, fillColors[text->fc]);
+		else if (text->bc == bgcolor) writeb(dst, *bgimg);
+		else writeb(dst, fillColors[text->bc]);
 	}
 }
 
@@ -175,9 +520,12 @@ void Screen::draw##bits(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
 	u8 red, green, blue; \
 	u8 pixel; \
 	type color; \
-	type *dst = (type *)(mVMemBase + y * mBytesPerLine + x * bytes_per_pixel); \
+	type *fb = (type *)(mVMemBase + y * mBytesPerLine + x * bytes_per_pixel); \
  \
-	for (; w--; pixmap++, dst++) { \
+	type buf[drawType == DrawBuffered ? w : 1]; \
+	type *dst = (drawType == DrawBuffered ? buf : fb); \
+ \
+	for (u32 i = w; i--; pixmap++, dst++) { \
 		pixel = *pixmap; \
  \
 		if (!pixel) fbwrite(dst, fillColors[bc]); \
@@ -191,45 +539,136 @@ void Screen::draw##bits(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
 			fbwrite(dst, color); \
 		} \
 	} \
+ \
+	if (drawType == DrawBuffered) memcpy(fb, buf, w * sizeof(type)); \
 }
 
 drawX(15, 5, 5, 5, u16, writew)
 drawX(16, 5, 6, 5, u16, writew)
 drawX(32, 8, 8, 8, u32, writel)
 
-#define drawXBg(bits, lred, lgreen, lblue, type, fbwrite) \
+static inline void writePixel(u8 *dst, u32 color)
+{
+	switch (bytes_per_pixel) {
+	case 1:
+		writeb(dst, color);
+		break;
+	case 2:
+		writew(dst, color);
+		break;
+	default:
+		writel(dst, color);
+		break;
+	}
+}
+
+// 8 bytes of pixels at dst, which is only 8 byte aligned when the cell x offset is. device memory
+// may fault on unaligned stores, those are split into pixel sized ones
+static inline void writeQuad(u8 *dst, u64 val)
+{
+	if (!((unsigned long)dst & 7)) {
+		writeq(dst, val);
+		return;
+	}
+
+	const u8 *src = (const u8 *)&val;
+	for (u32 i = 0; i < 8; i += bytes_per_pixel) {
+		switch (bytes_per_pixel) {
+		case 1:
+			writeb(dst + i, src[i]);
+			break;
+		case 2:
+			writew(dst + i, *(const u16 *)(src + i));
+			break;
+		default:
+			writel(dst + i, *(const u32 *)(src + i));
+			break;
+		}
+	}
+}
+
+// draw w pixels of a mono glyph row, starting skip bits into it. whole bytes are expanded
+// 8 pixels at a time without branching on pixels: back ^ ((fore ^ back) & mask)
+void Screen::drawBits(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *bits, u32 skip)
+{
+	bits += skip >> 3;
+	u32 bit = skip & 7;
+
+	if (textLayer) {
+		TextPixel *text = textLayer + (y * mBytesPerLine) / bytes_per_pixel + x;
+		for (u32 i = 0; i < w; i++, text++) {
+			text->fc = fc;
+			text->bc = bc;
+			text->alpha = (bits[(bit + i) >> 3] & (0x80 >> ((bit + i) & 7))) ? 0xff : 0;
+		}
+
+		(this->*compose)(x, y, w);
+		return;
+	}
+
+	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+
+	u64 fore = fillColors[fc], back = fillColors[bc];
+	fore |= fore << 32;
+	back |= back << 32;
+
+	while (w) {
+		if (bit || w < 8) {
+			writePixel(dst, (*bits & (0x80 >> bit)) ? fillColors[fc] : fillColors[bc]);
+			dst += bytes_per_pixel;
+
+			w--;
+			if (++bit == 8) {
+				bit = 0;
+				bits++;
+			}
+			continue;
+		}
+
+		const u64 *mask = monoMasks[*bits++];
+		for (u32 i = 0; i < bytes_per_pixel; i++, dst += 8) {
+			writeQuad(dst, back ^ ((fore ^ back) & mask[i]));
+		}
+		w -= 8;
+	}
+}
+
+#define composeX(bits, lred, lgreen, lblue, type, fbwrite) \
  \
-void Screen::draw##bits##Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
+void Screen::compose##bits(u32 x, u32 y, u32 w) \
 { \
-	if (bc != bgcolor) { \
-		draw##bits(x, y, w, fc, bc, pixmap); \
-		return; \
-	} \
- \
-	u8 red, green, blue; \
-	u8 redbg, greenbg, bluebg; \
-	u8 pixel; \
+	u8 red, green, blue, alpha; \
 	type color; \
  \
-	u32 offset = y * mBytesPerLine + x * bytes_per_pixel; \
-	type *dst = (type *)(mVMemBase + offset); \
-	type *bgimg = (type *)(bgimage_mem + offset); \
+	u32 index = (y * mBytesPerLine) / bytes_per_pixel + x; \
+	type *dst = (type *)mVMemBase + index; \
+	type *bgimg = (type *)bgimage_mem + index; \
+	Color *rgb = bgimage_rgb + index; \
+	TextPixel *text = textLayer + index; \
  \
-	for (; w--; pixmap++, dst++, bgimg++) { \
-		pixel = *pixmap; \
+	for (; w--; dst++, bgimg++, rgb++, text++) { \
+		alpha = text->alpha; \
  \
-		if (!pixel) fbwrite(dst, *bgimg); \
-		else if (pixel == 0xff) fbwrite(dst, fillColors[fc]); \
-		else { \
-			color = *bgimg; \
+		if (alpha == 0xff) fbwrite(dst, fillColors[text->fc]); \
+		else if (text->bc == bgcolor) { \
+			if (!alpha) { \
+				fbwrite(dst, *bgimg); \
+				continue; \
+			} \
  \
-			redbg = ((color >> (lgreen + lblue)) & ((1 << lred) - 1)) << (8 - lred); \
-			greenbg = ((color >> lblue) & ((1 << lgreen) - 1)) << (8 - lgreen); \
-			bluebg = (color & ((1 << lblue) - 1)) << (8 - lblue); \
+			const Color &fg = mPalette[text->fc]; \
+			red = rgb->red + (((fg.red - rgb->red) * alpha) >> 8); \
+			green = rgb->green + (((fg.green - rgb->green) * alpha) >> 8); \
+			blue = rgb->blue + (((fg.blue - rgb->blue) * alpha) >> 8); \
  \
-			red = redbg + (((mPalette[fc].red - redbg) * pixel) >> 8); \
-			green = greenbg + (((mPalette[fc].green - greenbg) * pixel) >> 8); \
-			blue = bluebg + (((mPalette[fc].blue - bluebg) * pixel) >> 8); \
+			color = ((red >> (8 - lred) << (lgreen + lblue)) | (green >> (8 - lgreen) << lblue) | (blue >> (8 - lblue))); \
+			fbwrite(dst, color); \
+		} else if (!alpha) fbwrite(dst, fillColors[text->bc]); \
+		else { \
+			const Color &fg = mPalette[text->fc], &bg = mPalette[text->bc]; \
+			red = bg.red + (((fg.red - bg.red) * alpha) >> 8); \
+			green = bg.green + (((fg.green - bg.green) * alpha) >> 8); \
+			blue = bg.blue + (((fg.blue - bg.blue) * alpha) >> 8); \
  \
 			color = ((red >> (8 - lred) << (lgreen + lblue)) | (green >> (8 - lgreen) << lblue) | (blue >> (8 - lblue))); \
 			fbwrite(dst, color); \
@@ -237,6 +676,139 @@ void Screen::draw##bits##Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
 	} \
 }
 
-drawXBg(15, 5, 5, 5, u16, writew)
-drawXBg(16, 5, 6, 5, u16, writew)
-drawXBg(32, 8, 8, 8, u32, writel)
+composeX(15, 5, 5, 5, u16, writew)
+composeX(16, 5, 6, 5, u16, writew)
+composeX(32, 8, 8, 8, u32, writel)
+
+// calibration times each way of writing against the first lines of video memory, the
+// fastest are remembered per driver and color depth so later starts only load them
+#define CALIBRATION_FILE ".fbterm-calibration"
+#define CALIBRATION_BYTES (256 * 1024)
+#define CALIBRATION_ROUNDS 4
+
+static u64 usecs()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool Screen::loadCalibration(const s8 *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) return false;
+
+	bool found = false;
+	u32 bpp, fillt, drawt, copyt;
+	s8 id[64];
+
+	while (!found && fscanf(file, "%u %u %u %u %63[^\n]", &bpp, &fillt, &drawt, &copyt, id) == 5) {
+		if (bpp != mBitsPerPixel || strcmp(id, drvId())) continue;
+		if (fillt >= NR_FILL_TYPES || drawt >= NR_DRAW_TYPES || copyt >= NR_COPY_TYPES) continue;
+
+		fillType = fillt;
+		drawType = drawt;
+		copyType = copyt;
+		found = true;
+	}
+
+	fclose(file);
+	return found;
+}
+
+void Screen::calibrate()
+{
+	bool enable = false;
+	Config::instance()->getOption("calibrate-video", enable);
+	if (!enable) return;
+
+	s8 name[128];
+	const s8 *home = getenv("HOME");
+	snprintf(name, sizeof(name), "%s/%s", home ? home : "/root", CALIBRATION_FILE);
+
+	calibrated = true;
+	if (loadCalibration(name)) return;
+
+	bool rotated = (mRotateType == Rotate90 || mRotateType == Rotate270);
+	u32 width = rotated ? mHeight : mWidth, height = rotated ? mWidth : mHeight;
+	u32 lines = MIN(height, CALIBRATION_BYTES / mBytesPerLine) & ~1;
+	if (lines < 2) return;
+
+	// the scratch lines are visible, put their content back when done
+	u32 size = lines * mBytesPerLine;
+	u8 *saved = new u8[size];
+	memcpy(saved, mVMemBase, size);
+
+	u64 start, fillCost[NR_FILL_TYPES], drawCost[NR_DRAW_TYPES], copyCost[NR_COPY_TYPES];
+
+	// fills of whole lines, as when clearing the screen
+	for (u32 type = 0; type < NR_FILL_TYPES; type++) {
+		fillType = type;
+		fillCost[type] = ~0ULL;
+		for (u32 round = 0; round < CALIBRATION_ROUNDS; round++) {
+			start = usecs();
+			fillRows(0, 0, width, lines, round);
+			fillCost[type] = MIN(fillCost[type], usecs() - start);
+		}
+	}
+
+	// glyph rows one cell wide, a background color other than the image's one is never blended with it
+	u32 cell = MIN(FW(1), width);
+	u8 pixmap[cell];
+	for (u32 i = 0; i < cell; i++) pixmap[i] = (i & 2) ? 0xff : 0;
+
+	for (u32 type = 0; type < NR_DRAW_TYPES; type++) {
+		drawType = type;
+		drawCost[type] = ~0ULL;
+		for (u32 round = 0; round < CALIBRATION_ROUNDS; round++) {
+			start = usecs();
+			for (u32 y = 0; y < lines; y++) {
+				for (u32 x = 0; x + cell <= width; x += cell) (this->*draw)(x, y, cell, 7, bgcolor ^ 1, pixmap);
+			}
+			drawCost[type] = MIN(drawCost[type], usecs() - start);
+		}
+	}
+
+	// lines copied inside video memory, as when scrolling without panning
+	for (u32 type = 0; type < NR_COPY_TYPES; type++) {
+		copyType = type;
+		copyCost[type] = ~0ULL;
+		for (u32 round = 0; round < CALIBRATION_ROUNDS; round++) {
+			start = usecs();
+			for (u32 y = 0; y < lines / 2; y++) {
+				moveSpan(mVMemBase + (y + lines / 2) * mBytesPerLine, mVMemBase + y * mBytesPerLine, width * bytes_per_pixel);
+			}
+			copyCost[type] = MIN(copyCost[type], usecs() - start);
+		}
+	}
+
+	memcpy(mVMemBase, saved, size);
+	delete[] saved;
+
+	fillType = drawType = copyType = 0;
+	for (u32 type = 1; type < NR_FILL_TYPES; type++) {
+		if (fillCost[type] < fillCost[fillType]) fillType = type;
+	}
+	for (u32 type = 1; type < NR_DRAW_TYPES; type++) {
+		if (drawCost[type] < drawCost[drawType]) drawType = type;
+	}
+	for (u32 type = 1; type < NR_COPY_TYPES; type++) {
+		if (copyCost[type] < copyCost[copyType]) copyType = type;
+	}
+
+	FILE *file = fopen(name, "a");
+	if (file) {
+		fprintf(file, "%u %u %u %u %s\n", mBitsPerPixel, fillType, drawType, copyType, drvId());
+		fclose(file);
+	}
+}
+
+void Screen::showStoreInfo()
+{
+	static const s8 * const fillstr[NR_FILL_TYPES] = { "long", "simd", "stream" };
+	static const s8 * const drawstr[NR_DRAW_TYPES] = { "direct", "buffered" };
+	static const s8 * const copystr[NR_COPY_TYPES] = { "memmove", "stream" };
+
+	printf("[screen] stores: fill %s, draw %s, copy %s%s\n", fillstr[fillType], drawstr[drawType], copystr[copyType],
+		calibrated ? " (calibrated)" : "");
+}
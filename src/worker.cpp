@@ -0,0 +1,148 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include "worker.h"
+#include "fbconfig.h"
+
+#define MAX_THREADS 16
+
+DEFINE_INSTANCE(WorkerPool)
+
+WorkerPool *WorkerPool::createInstance()
+{
+	return new WorkerPool();
+}
+
+WorkerPool::WorkerPool()
+{
+	u32 num = 0;
+	Config::instance()->getOption("render-threads", num);
+	if (!num) {
+		s32 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num = cpus > 0 ? cpus : 1;
+	}
+	if (num > MAX_THREADS) num = MAX_THREADS;
+
+	mThreadNum = 0;
+	mThreads = new pthread_t[num];
+	mFun = 0;
+	mArg = 0;
+	mParts = mNext = mFinished = mGeneration = 0;
+	mQuit = false;
+
+	pthread_mutex_init(&mLock, 0);
+	pthread_cond_init(&mStart, 0);
+	pthread_cond_init(&mDone, 0);
+
+	// signals are handled by the main thread only
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (u32 i = 1; i < num; i++) {
+		if (pthread_create(&mThreads[mThreadNum], 0, threadEntry, this)) break;
+		mThreadNum++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+WorkerPool::~WorkerPool()
+{
+	pthread_mutex_lock(&mLock);
+	mQuit = true;
+	pthread_cond_broadcast(&mStart);
+	pthread_mutex_unlock(&mLock);
+
+	for (u32 i = 0; i < mThreadNum; i++) {
+		pthread_join(mThreads[i], 0);
+	}
+
+	delete[] mThreads;
+	pthread_cond_destroy(&mDone);
+	pthread_cond_destroy(&mStart);
+	pthread_mutex_destroy(&mLock);
+}
+
+void *WorkerPool::threadEntry(void *arg)
+{
+	((WorkerPool *)arg)->work();
+	return 0;
+}
+
+void WorkerPool::work()
+{
+	u32 generation = 0;
+
+	pthread_mutex_lock(&mLock);
+	while (1) {
+		while (!mQuit && generation == mGeneration) {
+			pthread_cond_wait(&mStart, &mLock);
+		}
+		if (mQuit) break;
+
+		generation = mGeneration;
+		while (doPart());
+	}
+	pthread_mutex_unlock(&mLock);
+}
+
+// called with mLock held, returns false if no part is left to take
+bool WorkerPool::doPart()
+{
+	if (mNext >= mParts) return false;
+
+	u32 part = mNext++;
+	pthread_mutex_unlock(&mLock);
+
+	mFun(mArg, part);
+
+	pthread_mutex_lock(&mLock);
+	if (++mFinished == mParts) pthread_cond_signal(&mDone);
+	return true;
+}
+
+void WorkerPool::run(JobFun fun, void *arg, u32 parts)
+{
+	if (!parts) return;
+
+	if (!mThreadNum || parts == 1) {
+		for (u32 i = 0; i < parts; i++) fun(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&mLock);
+	mFun = fun;
+	mArg = arg;
+	mParts = parts;
+	mNext = mFinished = 0;
+	mGeneration++;
+	pthread_cond_broadcast(&mStart);
+
+	while (doPart());
+	while (mFinished != mParts) {
+		pthread_cond_wait(&mDone, &mLock);
+	}
+
+	mParts = 0;
+	pthread_mutex_unlock(&mLock);
+}
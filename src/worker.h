@@ -0,0 +1,54 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include "type.h"
+#include "instance.h"
+
+// persistent helper threads for splitting a job into independent parts,
+// the calling thread takes part as well and returns after all parts are done
+class WorkerPool {
+	DECLARE_INSTANCE(WorkerPool)
+public:
+	typedef void (*JobFun)(void *arg, u32 part);
+
+	u32 threads() { return mThreadNum + 1; }
+	void run(JobFun fun, void *arg, u32 parts);
+
+private:
+	static void *threadEntry(void *arg);
+	void work();
+	bool doPart();
+
+	u32 mThreadNum;
+	pthread_t *mThreads;
+	pthread_mutex_t mLock;
+	pthread_cond_t mStart, mDone;
+
+	JobFun mFun;
+	void *mArg;
+	u32 mParts, mNext, mFinished, mGeneration;
+	bool mQuit;
+};
+
+#endif